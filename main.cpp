@@ -8,6 +8,7 @@
 #include "src/General.hpp"
 #include "src/Camera.hpp"
 #include "src/Materials.hpp"
+#include "src/Integrator.hpp"
 
 #include <iostream>
 #include <cmath>
@@ -51,20 +52,10 @@ HittableList<double> random_scene() {
     return world;
 }
 
-ColorD ray_color(const Ray<double>& r, const HittableList<double>& world, int depth) {
-    if (depth < 1)
-        return ColorD(0, 0, 0);
-    HitRecord<double> rec;
-    if (world.hit(r, 0.0001, infinity, rec)) {
-        Ray<double> scattered;
-        ColorD attenuation;
-        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-            return attenuation*ray_color(scattered, world, depth-1);
-        return ColorD(0, 0, 0);
-    }
+//Radiance of rays that leave the scene
+ColorD sky(const Ray<double>& r) {
     auto t = 0.5*(r.direction().unit().y()+1.0);
     return (1.0 - t)*ColorD(1.0, 1.0, 1.0)+t*ColorD(0.5, 0.7, 1);
-
 }
 
 int main() {
@@ -86,10 +77,10 @@ int main() {
     double dist_to_focus = 10.0;
     double aperture = 0.1;
 
-    Camera<double> cam(lookfrom,  lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus);
+    Camera<double> cam(lookfrom,  lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
 
     //Render Image
-    PPM_IMAGE image(image_width, image_height);
+    IMAGE image(image_width, image_height);
 
     for (int j = image_height-1; j >= 0; --j) {
         std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
@@ -99,7 +90,7 @@ int main() {
                 double u = (i + random<double>(-1, 1))/(image_width-1);
                 double v = (j + random<double>(-1, 1))/(image_height-1);
                 Ray<double> r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, world, max_depth);
+                pixel_color += path_radiance(r, world, sky, max_depth);
             }
             write_color(image, j, i, pixel_color, samples_per_pixel);
         }
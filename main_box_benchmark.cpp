@@ -0,0 +1,97 @@
+#include "src/Point3.hpp"
+#include "src/Ray.hpp"
+#include "src/Vector3DF.hpp"
+#include "src/HittableObject.hpp"
+#include "src/HittableList.hpp"
+#include "src/General.hpp"
+#include "src/Materials.hpp"
+#include "src/Box.hpp"
+#include "src/BVH.hpp"
+
+#include <iostream>
+#include <cmath>
+#include <memory>
+#include <chrono>
+#include <vector>
+#include <random>
+
+
+//Compares the slab-test Box with the former six-rectangle RectBox on the ground of box_scene:
+//the same 20x20 boxes, the same rays, each set behind its own BVH.
+
+//Ground of box_scene built from boxes of type B, heights drawn from a fixed seed
+template<template<class> class B>
+HittableList<double> box_ground(std::shared_ptr<Material<double>> mat) {
+    HittableList<double> boxes;
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<double> height(0, 101);
+
+    const int boxes_per_side = 20;
+    for (int i = 0; i < boxes_per_side; i++) {
+        for (int j = 0; j < boxes_per_side; j++) {
+            auto w = 100.0;
+            auto x0 = -1000.0 + i*w;
+            auto z0 = -1000.0 + j*w;
+            boxes.add(std::make_shared<B<double>>(Point3D(x0, 0, z0), Point3D(x0 + w, height(gen), z0 + w), mat));
+        }
+    }
+    return boxes;
+}
+
+//Rays from above the ground at random positions, pointing down at random slants
+std::vector<Ray<double>> ground_rays(size_t n) {
+    std::vector<Ray<double>> rays;
+    std::mt19937 gen(2);
+    std::uniform_real_distribution<double> pos(-1000, 1000), slant(-1, 1);
+    for (size_t i = 0; i < n; i++)
+        rays.emplace_back(Point3D(pos(gen), 400, pos(gen)), Vector3D(slant(gen), -1, slant(gen)));
+    return rays;
+}
+
+struct BoxRun {
+    double seconds = 0;
+    size_t hits = 0;
+    double t_sum = 0;
+};
+
+BoxRun trace(const HittableObject<double>& world, const std::vector<Ray<double>>& rays, int rounds) {
+    BoxRun run;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int k = 0; k < rounds; k++) {
+        for (const auto& r : rays) {
+            HitRecord<double> rec;
+            if (world.hit(r, 0.001, infinity, rec)) {
+                run.hits++;
+                run.t_sum += rec.t;
+            }
+        }
+    }
+    run.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    return run;
+}
+
+
+int main() {
+    const size_t n_rays = 200000;
+    const int rounds = 5;
+
+    auto ground = std::make_shared<Lambertian<double>>(Vector3D(0.48, 0.83, 0.53));
+    auto slab = box_ground<Box>(ground);
+    auto rects = box_ground<RectBox>(ground);
+    BvhNode<double> slab_bvh(slab, 0, 1, BvhSplit::SAH);
+    BvhNode<double> rect_bvh(rects, 0, 1, BvhSplit::SAH);
+    auto rays = ground_rays(n_rays);
+
+    std::cerr << "Tracing " << n_rays*rounds << " rays against " << slab.objects.size() << " boxes.\n";
+    auto s = trace(slab_bvh, rays, rounds);
+    auto r = trace(rect_bvh, rays, rounds);
+
+    std::cerr << "Box (slab test):     " << s.seconds << "s, " << s.hits << " hits\n";
+    std::cerr << "RectBox (six rects): " << r.seconds << "s, " << r.hits << " hits\n";
+    std::cerr << "Speedup: " << r.seconds/s.seconds << "x\n";
+    if (s.hits != r.hits || std::abs(s.t_sum - r.t_sum) > 1e-6*std::abs(r.t_sum)) {
+        std::cerr << "Box and RectBox disagree\n";
+        return 1;
+    }
+    return 0;
+}
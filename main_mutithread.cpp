@@ -14,6 +14,15 @@
 #include "src/Box.hpp"
 #include "src/Medium.hpp"
 #include "src/BVH.hpp"
+#include "src/Instance.hpp"
+#include "src/Accelerator.hpp"
+#include "src/RayPacket.hpp"
+#include "src/Wavefront.hpp"
+#include "src/Integrator.hpp"
+#include "src/SceneArena.hpp"
+#include "src/TileScheduler.hpp"
+#include "src/ThreadManager.hpp"
+#include "src/Progress.hpp"
 
 #include <iostream>
 #include <cmath>
@@ -21,16 +30,20 @@
 #include <thread>
 #include <chrono>
 #include <atomic>
+#include <algorithm>
+#include <cstdlib>
+#include <string>
 
 
-//Atomic counter
-std::atomic<int> counter{ 0 };
+//Finished pixels of the frame being rendered
+Progress progress;
 
-HittableList<double> random_scene() {
+//Scene objects are placed in arena, which has to outlive the returned list
+HittableList<double> random_scene(SceneArena& arena) {
     HittableList<double> world;
 
-    auto ground_mat = std::make_shared<Lambertian<double>>(ColorD(0.3, 0.5, 0.2));
-    world.add(std::make_shared<Sphere<double>>(Point3D(0, -1000, 0), 1000, ground_mat));
+    auto ground_mat = arena.make<Lambertian<double>>(ColorD(0.3, 0.5, 0.2));
+    world.add(arena.make<Sphere<double>>(Point3D(0, -1000, 0), 1000, ground_mat));
 
     for (int a = -11; a < 11; a++) {
         for (int b = -11; b < 11; b++) {
@@ -42,31 +55,31 @@ HittableList<double> random_scene() {
                 Vector3<double> rnd = Vector3<double>(random<double>(0, 1), random<double>(0, 1), random<double>(0, 1));
                 if (choose < 0.7) {
                     ColorD albedo = rnd*rnd;
-                    sphere_material = std::make_shared<Lambertian<double>>(albedo);
-                    world.add(std::make_shared<Sphere<double>>(center, 0.2, sphere_material));
+                    sphere_material = arena.make<Lambertian<double>>(albedo);
+                    world.add(arena.make<Sphere<double>>(center, 0.2, sphere_material));
                 } else if ( choose < 0.95) {
                     ColorD albedo = rnd;
                     double fuzz = random<double>(0, 0.5);
-                    sphere_material = std::make_shared<Metal<double>>(albedo, fuzz);
-                    world.add(std::make_shared<Sphere<double>>(center, 0.18, sphere_material));
+                    sphere_material = arena.make<Metal<double>>(albedo, fuzz);
+                    world.add(arena.make<Sphere<double>>(center, 0.18, sphere_material));
                 } else {
-                    sphere_material = std::make_shared<Dielectric<double>>(1.5);
-                    world.add(std::make_shared<Sphere<double>>(center, 0.15, sphere_material));
+                    sphere_material = arena.make<Dielectric<double>>(1.5);
+                    world.add(arena.make<Sphere<double>>(center, 0.15, sphere_material));
                 }
             }
         }
     }
 
-    world.add(std::make_shared<Sphere<double>>(Point3D(0, 1, 0), 1.0, std::make_shared<Dielectric<double>>(1.5)));
-    world.add(std::make_shared<Sphere<double>>(Point3D(-4, 1, 0), 1.0, std::make_shared<Lambertian<double>>(ColorD(0.4, 0.2, 0.1))));
-    world.add(std::make_shared<Sphere<double>>(Point3D(4, 1, 0), 1.0, std::make_shared<Metal<double>>(ColorD(0.7, 0.6, 0.5), 0)));
+    world.add(arena.make<Sphere<double>>(Point3D(0, 1, 0), 1.0, arena.make<Dielectric<double>>(1.5)));
+    world.add(arena.make<Sphere<double>>(Point3D(-4, 1, 0), 1.0, arena.make<Lambertian<double>>(ColorD(0.4, 0.2, 0.1))));
+    world.add(arena.make<Sphere<double>>(Point3D(4, 1, 0), 1.0, arena.make<Metal<double>>(ColorD(0.7, 0.6, 0.5), 0)));
 
     return world;
 }
 
-HittableList<double> box_scene() {
+HittableList<double> box_scene(SceneArena& arena) {
     HittableList<double> boxes1;
-    auto ground = std::make_shared<Lambertian<double>>(ColorD(0.48, 0.83, 0.53));
+    auto ground = arena.make<Lambertian<double>>(ColorD(0.48, 0.83, 0.53));
 
     const int boxes_per_side = 20;
     for (int i = 0; i < boxes_per_side; i++) {
@@ -79,89 +92,108 @@ HittableList<double> box_scene() {
             auto y1 = 101*fast_random<double>();
             auto z1 = z0 + w;
 
-            boxes1.add(std::make_shared<Box<double>>(Point3D(x0,y0,z0), Point3D(x1,y1,z1), ground));
+            boxes1.add(arena.make<Box<double>>(Point3D(x0,y0,z0), Point3D(x1,y1,z1), ground));
         }
     }
 
     HittableList<double> objects;
 
-    objects.add(std::make_shared<BvhNode<double>>(boxes1, 0, 1));
+    objects.add(arena.make<BvhNode<double>>(boxes1, 0, 1, BvhSplit::SAH));
 
-    auto light = std::make_shared<DiffuseLight<double>>(ColorD(15, 15, 10));
-    objects.add(std::make_shared<XZRect<double>>(123, 423, 147, 412, 554, light));
+    auto light = arena.make<DiffuseLight<double>>(ColorD(15, 15, 10));
+    objects.add(arena.make<XZRect<double>>(123, 423, 147, 412, 554, light));
 
     auto center1 = Point3D(400, 400, 200);
     auto center2 = center1 + Vector3D(30,0,0);
-    auto moving_sphere_material = std::make_shared<Lambertian<double>>(ColorD(0.7, 0.3, 0.1));
-    objects.add(std::make_shared<MovingSphere<double>>(center1, center2, 0, 1, 50, moving_sphere_material));
+    auto moving_sphere_material = arena.make<Lambertian<double>>(ColorD(0.7, 0.3, 0.1));
+    objects.add(arena.make<MovingSphere<double>>(center1, center2, 0, 1, 50, moving_sphere_material));
 
-    objects.add(std::make_shared<Sphere<double>>(Point3D(260, 150, 45), 50, std::make_shared<Dielectric<double>>(1.5)));
-    objects.add(std::make_shared<Sphere<double>>(Point3D(0, 150, 145), 50, std::make_shared<Metal<double>>(ColorD(0.8, 0.8, 0.9), 1.0)));
+    objects.add(arena.make<Sphere<double>>(Point3D(260, 150, 45), 50, arena.make<Dielectric<double>>(1.5)));
+    objects.add(arena.make<Sphere<double>>(Point3D(0, 150, 145), 50, arena.make<Metal<double>>(ColorD(0.8, 0.8, 0.9), 1.0)));
 
-    auto boundary = std::make_shared<Sphere<double>>(Point3D(360,150,145), 70, std::make_shared<Dielectric<double>>(1.5));
+    auto boundary = arena.make<Sphere<double>>(Point3D(360,150,145), 70, arena.make<Dielectric<double>>(1.5));
     objects.add(boundary);
-    objects.add(std::make_shared<ConstantMedium<double>>(boundary, 0.2, ColorD(0.2, 0.4, 0.9)));
-    boundary = std::make_shared<Sphere<double>>(Point3D(0, 0, 0), 5000, std::make_shared<Dielectric<double>>(1.5));
-    objects.add(std::make_shared<ConstantMedium<double>>(boundary, .0001, ColorD(1,1,1)));
+    objects.add(arena.make<ConstantMedium<double>>(boundary, 0.2, ColorD(0.2, 0.4, 0.9)));
+    boundary = arena.make<Sphere<double>>(Point3D(0, 0, 0), 5000, arena.make<Dielectric<double>>(1.5));
+    objects.add(arena.make<ConstantMedium<double>>(boundary, .0001, ColorD(1,1,1)));
 
-    auto emat = std::make_shared<Lambertian<double>>(std::make_shared<ImageTexture<double>>("earthmap.jpg"));
-    objects.add(std::make_shared<Sphere<double>>(Point3D(400,200,400), 100, emat));
-    auto pertext = std::make_shared<NoiseTexture<double>>(0.1);
-    objects.add(std::make_shared<Sphere<double>>(Point3D(220,280,300), 80, std::make_shared<Lambertian<double>>(pertext)));
+    auto emat = arena.make<Lambertian<double>>(arena.make<ImageTexture<double>>("earthmap.jpg"));
+    objects.add(arena.make<Sphere<double>>(Point3D(400,200,400), 100, emat));
+    auto pertext = arena.make<NoiseTexture<double>>(0.1);
+    objects.add(arena.make<Sphere<double>>(Point3D(220,280,300), 80, arena.make<Lambertian<double>>(pertext)));
 
     HittableList<double> boxes2;
-    auto white = std::make_shared<Lambertian<double>>(ColorD(.73, .73, .73));
+    auto white = arena.make<Lambertian<double>>(ColorD(.73, .73, .73));
     int ns = 1000;
     for (int j = 0; j < ns; j++) {
-        boxes2.add(std::make_shared<Sphere<double>>(Vector3<double>(165*fast_random<double>(), 165*fast_random<double>(), 165*fast_random<double>()), 10, white));
+        boxes2.add(arena.make<Sphere<double>>(Vector3<double>(165*fast_random<double>(), 165*fast_random<double>(), 165*fast_random<double>()), 10, white));
     }
 
-    objects.add(std::make_shared<Translate<double>>(std::make_shared<RotateY<double>>(
-            std::make_shared<BvhNode<double>>(boxes2, 0.0, 1.0), 15),
+    objects.add(arena.make<Translate<double>>(arena.make<RotateY<double>>(
+            arena.make<BvhNode<double>>(boxes2, 0.0, 1.0, BvhSplit::SAH), 15),
             Vector3D(100,220,395)));
 
     return objects;
 }
 
-ColorD ray_color(const Ray<double>& r, const ColorD& background, const HittableList<double>& world, int depth) {
-    if (depth < 1)
-        return ColorD(0, 0, 0);
-    HitRecord<double> rec;
-    if (!world.hit(r, 0.0001, infinity, rec))
-        return background;
+//Threading: tiles are pulled by the workers of the ThreadManager pool
+constexpr int TILE_SIZE = TileScheduler::default_tile_size;
 
-    Ray<double> scattered;
-    ColorD attenuation;
-    ColorD emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+//Primary rays of a block of PACKET_W x PACKET_H pixels are traced together
+constexpr int PACKET_W = 4;
+constexpr int PACKET_H = 2;
+constexpr int PACKET_SIZE = PACKET_W*PACKET_H;
 
-    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-        return emitted;
+void COMPUTE(IMAGE& image, const Tile& tile, int spp, int depth, const Camera<double>& cam, const HittableObject<double>& world, const ColorD& background) {
+    PacketTracer<double, PACKET_SIZE> tracer(world);
+    auto sky = [&](const Ray<double>&) { return background;};
 
-    return emitted + attenuation*ray_color(scattered, background, world, depth-1);
-}
-
-//Threading
-constexpr int MAX_THREADS = 4;
+    for (int top = tile.y1-1; top >= tile.y0; top -= PACKET_H) {
+        int rows = std::min(PACKET_H, top - tile.y0 + 1);
+        for (int left = tile.x0; left < tile.x1; left += PACKET_W) {
+            int cols = std::min(PACKET_W, tile.x1 - left);
+            int n = rows*cols;
 
-void COMPUTE(IMAGE& image, int begin, int end, int spp, int depth, Camera<double>& cam, HittableList<double>& world, const ColorD& background) {
-    for (int j = end-1; j >= begin; --j) {
-        for (int i = 0; i < image.width; ++i) {
-            ColorD pixel_color;
+            ColorD pixel_color[PACKET_SIZE];
             for (int s = 0; s < spp; ++s) {
-                double u = (i + random<double>(-1, 1))/(image.width - 1);
-                double v = (j + random<double>(-1, 1))/(image.height-1);
-                Ray<double> r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, background, world, depth);
+                Ray<double> rays[PACKET_SIZE];
+                for (int k = 0; k < n; ++k) {
+                    double u = (left + k%cols + random<double>(-1, 1))/(image.width - 1);
+                    double v = (top - k/cols + random<double>(-1, 1))/(image.height-1);
+                    rays[k] = cam.get_ray(u, v);
+                }
+
+                HitRecord<double> recs[PACKET_SIZE];
+                bool hits[PACKET_SIZE];
+                tracer.trace(rays, n, 0.0001, infinity, recs, hits);
+                for (int k = 0; k < n; ++k)
+                    pixel_color[k] += hits[k] ? path_radiance(rays[k], world, sky, depth, &recs[k]) : background;
             }
-            write_color(image, j, i, pixel_color, spp);
-            counter.fetch_add(1, std::memory_order_relaxed);
+
+            for (int k = 0; k < n; ++k)
+                write_color(image, top - k/cols, left + k%cols, pixel_color[k], spp);
         }
     }
+    progress.add(tile.pixels());
+}
 
+//Wavefront tiles span whole rows, which is what the renderer works on
+void COMPUTE_WAVEFRONT(IMAGE& image, const Tile& tile, int spp, int depth, const Camera<double>& cam, const HittableObject<double>& world, const ColorD& background) {
+    WavefrontRenderer<double> renderer(world, cam, background, depth);
+    renderer.render(image, tile.y0, tile.y1, spp, &progress);
 }
 
 
-int main() {   
+//BVH cache file from the first argument, or from RT_BVH_CACHE; without one the tree is always built
+std::string bvh_cache_path(int argc, char* argv[]) {
+    if(argc > 1)
+        return argv[1];
+    const char* env = std::getenv("RT_BVH_CACHE");
+    return env ? env : "";
+}
+
+
+int main(int argc, char* argv[]) {
     //Image settingis
     const double aspect_ratio = 1.0;
     const double vfov = 40.0; //vertical field of view in degrees
@@ -169,31 +201,30 @@ int main() {
     const int image_height = static_cast<int>(image_width/aspect_ratio);
     const int samples_per_pixel = 100;
     const int max_depth = 50;
+    const bool wavefront = false; //stream path tracer instead of one path at a time
 
     //World setup
+    auto build_start = std::chrono::high_resolution_clock::now();
+    SceneArena arena; // owns the scene objects until the render is written
     HittableList<double> world;
 
-    auto red   = std::make_shared<Lambertian<double>>(ColorD(.65, .05, .05));
-    auto white = std::make_shared<Lambertian<double>>(ColorD(.73, .73, .73));
-    auto green = std::make_shared<Lambertian<double>>(ColorD(.12, .45, .15));
-    auto light = std::make_shared<DiffuseLight<double>>(ColorD(15, 15, 15));
+    auto red   = arena.make<Lambertian<double>>(ColorD(.65, .05, .05));
+    auto white = arena.make<Lambertian<double>>(ColorD(.73, .73, .73));
+    auto green = arena.make<Lambertian<double>>(ColorD(.12, .45, .15));
+    auto light = arena.make<DiffuseLight<double>>(ColorD(15, 15, 15));
 
-    world.add(std::make_shared<YZRect<double>>(0, 555, 0, 555, 555, green));
-    world.add(std::make_shared<YZRect<double>>(0, 555, 0, 555, 0, red));
-    world.add(std::make_shared<XZRect<double>>(213, 343, 227, 332, 554, light));
-    world.add(std::make_shared<XZRect<double>>(0, 555, 0, 555, 0, white));
-    world.add(std::make_shared<XZRect<double>>(0, 555, 0, 555, 555, white));
-    world.add(std::make_shared<XYRect<double>>(0, 555, 0, 555, 555, white));
+    world.add(arena.make<YZRect<double>>(0, 555, 0, 555, 555, green));
+    world.add(arena.make<YZRect<double>>(0, 555, 0, 555, 0, red));
+    world.add(arena.make<XZRect<double>>(213, 343, 227, 332, 554, light));
+    world.add(arena.make<XZRect<double>>(0, 555, 0, 555, 0, white));
+    world.add(arena.make<XZRect<double>>(0, 555, 0, 555, 555, white));
+    world.add(arena.make<XYRect<double>>(0, 555, 0, 555, 555, white));
 
-    std::shared_ptr<HittableObject<double>> box1 = std::make_shared<Box<double>>(Point3D(0, 0, 0), Point3D(165, 330, 165), white);
-    box1 = std::make_shared<RotateY<double>>(box1, 15);
-    box1 = std::make_shared<Translate<double>>(box1, Vector3D(265, 0, 295));
-    world.add(box1);
+    auto box1 = arena.make<Box<double>>(Point3D(0, 0, 0), Point3D(165, 330, 165), white);
+    world.add(arena.make<Instance<double>>(box1, Transform<double>::translate(Vector3D(265, 0, 295))*Transform<double>::rotate_y(15)));
 
-    std::shared_ptr<HittableObject<double>> box2 = std::make_shared<Box<double>>(Point3D(0, 0, 0), Point3D(165, 165, 165), white);
-    box2 = std::make_shared<RotateY<double>>(box2, -18);
-    box2 = std::make_shared<Translate<double>>(box2, Vector3D(130, 0, 65));
-    world.add(box2);
+    auto box2 = arena.make<Box<double>>(Point3D(0, 0, 0), Point3D(165, 165, 165), white);
+    world.add(arena.make<Instance<double>>(box2, Transform<double>::translate(Vector3D(130, 0, 65))*Transform<double>::rotate_y(-18)));
 
     //Camera settingis
     Point3D lookfrom(278, 278, -800);
@@ -205,28 +236,45 @@ int main() {
 
     Camera<double> cam(lookfrom,  lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
 
+    //Acceleration structure over the whole world, tiny scenes stay a plain list.
+    //Re-renders of an unchanged scene load the tree from the cache file instead of building it.
+    auto accel = build_accelerator(world, 0.0, 1.0, default_linear_max_objects, BvhSplit::SAH, bvh_cache_path(argc, argv));
+
+    std::chrono::duration<double> build_time = std::chrono::high_resolution_clock::now() - build_start;
+    std::cerr << "Scene built in " << build_time.count() << "s\n" << std::flush;
+
     //Render Image
+    auto render_start = std::chrono::high_resolution_clock::now();
     IMAGE image(image_width, image_height);
 
-    std::vector<std::thread> threads;
-    int part = static_cast<int>(image_height/MAX_THREADS);
-    std::cerr << "Setting threads.\n" << std::flush;
-    for(int i = 0; i < MAX_THREADS - 1; i++)
-        threads.emplace_back(std::thread(COMPUTE, std::ref(image), i*part, (i+1)*part,
-                                         samples_per_pixel, max_depth, std::ref(cam),
-                                         std::ref(world), std::ref(background)));
-    threads.emplace_back(std::thread(COMPUTE, std::ref(image), (MAX_THREADS-1)*part, image_height,
-                                     samples_per_pixel, max_depth, std::ref(cam),
-                                     std::ref(world), std::ref(background)));
-
-    int total_pixels = image_height*image_width;
-    while(counter.load() < total_pixels - 1){
-        std::cerr << "\rComputing image: " << static_cast<int>(counter.load()*100/total_pixels) << '%' << std::flush;
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
-    }
-    for(auto& t : threads)
-        t.join();
-    std::cerr << "\rComputing image: " << static_cast<int>(counter.load()*100/total_pixels) << '%' << std::flush;
+    auto compute = wavefront ? COMPUTE_WAVEFRONT : COMPUTE;
+    TileScheduler tiles(image_width, image_height, wavefront ? image_width : TILE_SIZE, TILE_SIZE);
+    auto pool = ThreadManager::get_instance();
+    progress.reset(static_cast<size_t>(image_width)*image_height);
+    std::cerr << "Rendering " << tiles.size() << " tiles on " << pool->size() << " threads.\n" << std::flush;
+    auto pending = tiles.start([&](const Tile& tile, unsigned) {
+        try {
+            compute(image, tile, samples_per_pixel, max_depth, cam, *accel, background);
+        } catch(...) {
+            //the frame cannot complete, stop waiting for it; get() below rethrows
+            progress.cancel();
+            throw;
+        }
+    }, *pool);
+
+    //reports every 500 ms, returns as soon as the last tile is done
+    while(!progress.wait_for(std::chrono::milliseconds(500)))
+        std::cerr << "\rComputing image: " << progress.percent() << '%' << std::flush;
+    for(auto& f : pending)
+        f.wait();
+    std::vector<double> busy;
+    for(auto& f : pending)
+        busy.push_back(f.get());
+    std::cerr << "\rComputing image: " << progress.percent() << '%' << std::flush;
+    std::chrono::duration<double> render_time = std::chrono::high_resolution_clock::now() - render_start;
+    std::cerr << "\nRendered in " << render_time.count() << "s" << std::flush;
+    for(size_t i = 0; i < busy.size(); i++)
+        std::cerr << "\nThread " << i << " busy " << busy[i] << "s" << std::flush;
 
 
     std::cerr << "\nWriting in file.\n" << std::flush;
@@ -8,6 +8,10 @@
 #include "src/General.hpp"
 #include "src/Camera.hpp"
 #include "src/Materials.hpp"
+#include "src/Integrator.hpp"
+#include "src/TileScheduler.hpp"
+#include "src/ThreadManager.hpp"
+#include "src/Progress.hpp"
 
 #include <iostream>
 #include <cmath>
@@ -18,8 +22,8 @@
 #include <sstream>
 
 
-//Atomic counter
-std::atomic<int> counter{ 0 };
+//Finished pixels of the frame being rendered
+Progress progress;
 
 HittableList<double> random_scene() {
     HittableList<double> world;
@@ -59,40 +63,29 @@ HittableList<double> random_scene() {
     return world;
 }
 
-ColorD ray_color(const Ray<double>& r, const HittableList<double>& world, int depth) {
-    if (depth < 1)
-        return ColorD(0, 0, 0);
-    HitRecord<double> rec;
-    if (world.hit(r, 0.0001, infinity, rec)) {
-        Ray<double> scattered;
-        ColorD attenuation;
-        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-            return attenuation*ray_color(scattered, world, depth-1);
-        return ColorD(0, 0, 0);
-    }
+//Radiance of rays that leave the scene
+ColorD sky(const Ray<double>& r) {
     auto t = 0.5*(r.direction().unit().y()+1.0);
     return (1.0 - t)*ColorD(1.0, 1.0, 1.0)+t*ColorD(0.5, 0.7, 1);
-
 }
 
-//Threading
-constexpr int MAX_THREADS = 4;
+//Threading: tiles are pulled by the workers of the ThreadManager pool, started once for all frames
+constexpr int TILE_SIZE = TileScheduler::default_tile_size;
 
-void COMPUTE(PPM_IMAGE& image, int begin, int end, int spp, int depth, Camera<double>& cam, HittableList<double>& world) {
-    for (int j = end-1; j >= begin; --j) {
-        for (int i = 0; i < image.width; ++i) {
+void COMPUTE(IMAGE& image, const Tile& tile, int spp, int depth, const Camera<double>& cam, const HittableList<double>& world) {
+    for (int j = tile.y1-1; j >= tile.y0; --j) {
+        for (int i = tile.x0; i < tile.x1; ++i) {
             ColorD pixel_color;
             for (int s = 0; s < spp; ++s) {
                 double u = (i + random<double>(-1, 1))/(image.width - 1);
                 double v = (j + random<double>(-1, 1))/(image.height-1);
                 Ray<double> r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, world, depth);
+                pixel_color += path_radiance(r, world, sky, depth);
             }
             write_color(image, j, i, pixel_color, spp);
-            counter.fetch_add(1, std::memory_order_relaxed);;
         }
     }
-
+    progress.add(tile.pixels());
 }
 
 
@@ -108,6 +101,9 @@ int main() {
     //World setup
     HittableList<double> world = random_scene();
 
+    auto pool = ThreadManager::get_instance();
+    TileScheduler tiles(image_width, image_height, TILE_SIZE, TILE_SIZE);
+
     int T_MAX = 69;
     for(int t = 0; t <= T_MAX; t++){
         auto start = std::chrono::high_resolution_clock::now();
@@ -118,32 +114,32 @@ int main() {
         double dist_to_focus = 9.0;//std::abs(12-t)*9/12 + 1;
         double aperture = 0.1;//*(std::abs(T_MAX-2*t)/T_MAX + 1);
 
-        Camera<double> cam(lookfrom,  lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus);
+        Camera<double> cam(lookfrom,  lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
 
         //Render Animation
 
-        PPM_IMAGE image(image_width, image_height);
-
-        std::vector<std::thread> threads;
-        int part = static_cast<int>(image_height/MAX_THREADS);
-
-        std::cerr << "Setting threads\n" << std::flush;
-        for(int i = 0; i < MAX_THREADS - 1; i++)
-            threads.emplace_back(std::thread(COMPUTE, std::ref(image), i*part, (i+1)*part,
-                                             samples_per_pixel, max_depth, std::ref(cam),
-                                             std::ref(world)));
-        threads.emplace_back(std::thread(COMPUTE, std::ref(image), (MAX_THREADS-1)*part, image_height,
-                                         samples_per_pixel, max_depth, std::ref(cam),
-                                         std::ref(world)));
+        IMAGE image(image_width, image_height);
+
+        tiles.reset();
+        progress.reset(static_cast<size_t>(image_width)*image_height);
+        auto pending = tiles.start([&](const Tile& tile, unsigned) {
+            try {
+                COMPUTE(image, tile, samples_per_pixel, max_depth, cam, world);
+            } catch(...) {
+                //the frame cannot complete, stop waiting for it; get() below rethrows
+                progress.cancel();
+                throw;
+            }
+        }, *pool);
 
-        int total_pixels = image_height*image_width;
-        while(counter.load() < total_pixels - 1){
-            std::cerr << "\rComputing frame " << t+1 <<  ": " << static_cast<int>(counter.load()*100/total_pixels) << '%' << std::flush;
-            std::this_thread::sleep_for(std::chrono::milliseconds(500));
-        }
-        std::cerr << "\rComputing frame " << t+1 <<  ": " << static_cast<int>(counter.load()*100/total_pixels) << '%' << std::flush;
-        for(auto& th : threads)
-            th.join();
+        //reports every 500 ms, returns as soon as the last tile is done
+        while(!progress.wait_for(std::chrono::milliseconds(500)))
+            std::cerr << "\rComputing frame " << t+1 <<  ": " << progress.percent() << '%' << std::flush;
+        std::cerr << "\rComputing frame " << t+1 <<  ": " << progress.percent() << '%' << std::flush;
+        for(auto& f : pending)
+            f.wait();
+        for(auto& f : pending)
+            f.get();
 
 
         std::cerr << "\nWriting in file.\n" << std::flush;
@@ -152,7 +148,6 @@ int main() {
         std::stringstream path;
         path << "png/frame" << t << ".png";
         image.print_to_png(path.str());
-        counter.fetch_sub(counter.load());
 
         auto end = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double, std::milli> elapsed = end-start;
@@ -16,9 +16,9 @@ public:
 
     bool hit(const Ray<T>& r, T t_min, T t_max) const {
         for(int i = 0; i < 3; i++) {
-            auto invD = 1.0f/r.dir[i];
-            auto t0 = invD*(minimum[i] - r.orig[i]);
-            auto t1 = invD*(maximum[i] - r.orig[i]);
+            auto invD = 1.0f/r.dir.e[i];
+            auto t0 = invD*(minimum.e[i] - r.orig.e[i]);
+            auto t1 = invD*(maximum.e[i] - r.orig.e[i]);
 
             if(invD < 0.0f)
                 std::swap(t0, t1);
@@ -33,6 +33,13 @@ public:
         return true;
     }
 
+    T surface_area() const {
+        auto d = maximum - minimum;
+        return 2*(d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+    }
+
+    Vector3<T> center() const { return 0.5*(minimum + maximum);}
+
     static AABB surrounding_box(AABB<T> b1, AABB<T> b2) {
         Vector3<T> small(fmin(b1.minimum.x(), b2.minimum.x()),
                          fmin(b1.minimum.y(), b2.minimum.y()),
@@ -40,7 +40,7 @@ bool XYRect<T>::hit(const Ray<T>& r, T t_min, T t_max, HitRecord<T>& rec) const
     rec.t = t;
     auto out_norm = Vector3<T>(0, 0, 1);
     rec.set_face_normal(r, out_norm);
-    rec.mat_ptr = mp;
+    rec.mat_ptr = mp.get();
     rec.p = r.at(t);
     return true;
 }
@@ -80,7 +80,7 @@ bool XZRect<T>::hit(const Ray<T>& r, T t_min, T t_max, HitRecord<T>& rec) const
     rec.t = t;
     auto out_norm = Vector3<T>(0, 1, 0);
     rec.set_face_normal(r, out_norm);
-    rec.mat_ptr = mp;
+    rec.mat_ptr = mp.get();
     rec.p = r.at(t);
     return true;
 }
@@ -120,7 +120,7 @@ bool YZRect<T>::hit(const Ray<T>& r, T t_min, T t_max, HitRecord<T>& rec) const
     rec.t = t;
     auto out_norm = Vector3<T>(1, 0, 0);
     rec.set_face_normal(r, out_norm);
-    rec.mat_ptr = mp;
+    rec.mat_ptr = mp.get();
     rec.p = r.at(t);
     return true;
 }
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "HittableObject.hpp"
+#include "HittableList.hpp"
+#include "LinearBVH.hpp"
+#include "BvhCache.hpp"
+#include "MotionBVH.hpp"
+#include "SphereSet.hpp"
+
+#include <memory>
+#include <string>
+
+
+//Below this many objects a linear scan of the list beats building and walking a tree
+constexpr size_t default_linear_max_objects = 8;
+
+//True when some object's bounds differ between the two ends of the shutter
+template<class T>
+bool has_motion(const HittableList<T>& world, T time0, T time1) {
+    for(const auto& obj : world.objects) {
+        AABB<T> b0, b1;
+        if(!obj->bounding_box(time0, time0, b0) || !obj->bounding_box(time1, time1, b1))
+            continue;
+        for(int a = 0; a < 3; a++) {
+            if(b0.minimum.e[a] != b1.minimum.e[a] || b0.maximum.e[a] != b1.maximum.e[a])
+                return true;
+        }
+    }
+    return false;
+}
+
+//What the renderer traces against: the world itself when it is tiny, a MotionBvh when anything
+//moves during the shutter, a LinearBvh otherwise. A scene of mostly plain spheres is traced as a
+//SphereSet next to a list of the rest; with more than a few other objects the set would overlap
+//a second tree, which costs more than its batched leaves save. With a cache_path the LinearBvh
+//is reused from disk when the scene has not changed.
+template<class T>
+std::shared_ptr<HittableObject<T>> build_accelerator(const HittableList<T>& world, T time0, T time1,
+                                                     size_t linear_max_objects = default_linear_max_objects,
+                                                     BvhSplit split = BvhSplit::SAH,
+                                                     const std::string& cache_path = "") {
+    //objects left once the spheres are packed, counted first so the set is only built when used
+    size_t spheres = count_plain_spheres(world);
+    size_t packed_size = spheres >= default_sphere_set_min ? world.objects.size() - spheres + 1 : world.objects.size();
+    if(packed_size < linear_max_objects)
+        return std::make_shared<HittableList<T>>(gather_spheres(world));
+    if(has_motion(world, time0, time1))
+        return std::make_shared<MotionBvh<T>>(world, time0, time1);
+    if(!cache_path.empty())
+        return cached_bvh(cache_path, world, time0, time1, split);
+    return std::make_shared<LinearBvh<T>>(world, time0, time1, split);
+}
@@ -6,10 +6,438 @@
 #include "Ray.hpp"
 
 #include <memory>
-#include <cassert>
 #include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <future>
+#include <thread>
+#include <cstdint>
 
 
+//Morton sorts centroids along a 30-bit Z-curve and splits on the code bits (LBVH),
+//HLBVH does the same but picks the top levels with SAH over Morton clusters,
+//SBVH adds spatial splits that clip straddling objects (LinearBvh only, BvhNode treats it as SAH)
+enum class BvhSplit { Median, SAH, Morton, HLBVH, SBVH };
+
+//Binned SAH split over the centroid bounds of a range of objects
+template<class T>
+class SahSplit {
+public:
+    static constexpr int bins = 12;
+    static constexpr int max_leaf_size = 4;
+    static constexpr double traversal_cost = 0.125;
+    static constexpr double intersection_cost = 1.0;
+
+    int axis = -1; // -1 if all centroids coincide and there is nothing to split
+    int bin = 0;
+    T cost = infinity;
+    AABB<T> centroid_box;
+
+    int bin_of(const Vector3<T>& c) const {
+        auto extent = centroid_box.maximum.e[axis] - centroid_box.minimum.e[axis];
+        int b = static_cast<int>(bins*(c.e[axis] - centroid_box.minimum.e[axis])/extent);
+        return b < bins ? b : bins - 1;
+    }
+    bool goes_left(const Vector3<T>& c) const { return bin_of(c) <= bin;}
+    bool make_leaf(size_t n) const { return n <= static_cast<size_t>(max_leaf_size) && cost >= n*intersection_cost;}
+};
+
+template<class T, class It, class BoxOf>
+SahSplit<T> find_sah_split(It first, It last, BoxOf box_of) {
+    SahSplit<T> split;
+    const Vector3<T> inf(infinity, infinity, infinity);
+    AABB<T> bounds(inf, -inf);
+    split.centroid_box = AABB<T>(inf, -inf);
+
+    for(auto it = first; it != last; ++it) {
+        AABB<T> b = box_of(*it);
+        auto c = b.center();
+        bounds = AABB<T>::surrounding_box(bounds, b);
+        split.centroid_box = AABB<T>::surrounding_box(split.centroid_box, AABB<T>(c, c));
+    }
+
+    auto area = bounds.surface_area();
+    constexpr int n_bins = SahSplit<T>::bins;
+
+    for(int axis = 0; axis < 3; axis++) {
+        if(split.centroid_box.maximum.e[axis] <= split.centroid_box.minimum.e[axis])
+            continue;
+
+        SahSplit<T> probe = split;
+        probe.axis = axis;
+
+        size_t count[n_bins] = {};
+        AABB<T> box[n_bins];
+        for(int b = 0; b < n_bins; b++)
+            box[b] = AABB<T>(inf, -inf);
+
+        for(auto it = first; it != last; ++it) {
+            AABB<T> b = box_of(*it);
+            int i = probe.bin_of(b.center());
+            count[i]++;
+            box[i] = AABB<T>::surrounding_box(box[i], b);
+        }
+
+        //sweep from the right to get the cost of the right side of every split plane
+        T right_cost[n_bins];
+        AABB<T> acc(inf, -inf);
+        size_t acc_count = 0;
+        for(int b = n_bins - 1; b > 0; b--) {
+            acc = AABB<T>::surrounding_box(acc, box[b]);
+            acc_count += count[b];
+            right_cost[b - 1] = acc_count ? acc_count*acc.surface_area() : 0;
+        }
+
+        acc = AABB<T>(inf, -inf);
+        acc_count = 0;
+        for(int b = 0; b < n_bins - 1; b++) {
+            acc = AABB<T>::surrounding_box(acc, box[b]);
+            acc_count += count[b];
+            T left_cost = acc_count ? acc_count*acc.surface_area() : 0;
+            T cost = SahSplit<T>::traversal_cost + SahSplit<T>::intersection_cost*(left_cost + right_cost[b])/area;
+            if(cost < split.cost) {
+                split.axis = axis;
+                split.bin = b;
+                split.cost = cost;
+            }
+        }
+    }
+
+    return split;
+}
+
+//Spatial split plane for SBVH: objects straddling the plane go to both sides,
+//each with its box clipped to that side
+template<class T>
+class SpatialSplit {
+public:
+    static constexpr int bins = 16;
+    static constexpr double min_overlap = 1e-5;  // relative to the root area, below it spatial splits are not tried
+    static constexpr double max_duplication = 0.3; // extra references allowed, as a fraction of the object count
+
+    int axis = -1;
+    T position = 0;
+    T cost = infinity;
+    size_t duplicates = 0;
+};
+
+template<class T, class It, class BoxOf>
+SpatialSplit<T> find_spatial_split(It first, It last, const AABB<T>& bounds, BoxOf box_of) {
+    SpatialSplit<T> split;
+    const Vector3<T> inf(infinity, infinity, infinity);
+    constexpr int n_bins = SpatialSplit<T>::bins;
+    auto area = bounds.surface_area();
+    size_t n = std::distance(first, last);
+
+    for(int axis = 0; axis < 3; axis++) {
+        T lo = bounds.minimum.e[axis];
+        T width = (bounds.maximum.e[axis] - lo)/n_bins;
+        if(width <= 0)
+            continue;
+
+        AABB<T> box[n_bins];
+        size_t enter[n_bins] = {}, exit[n_bins] = {};
+        for(int b = 0; b < n_bins; b++)
+            box[b] = AABB<T>(inf, -inf);
+
+        for(auto it = first; it != last; ++it) {
+            AABB<T> ref = box_of(*it);
+            int b0 = clamp<int>(static_cast<int>((ref.minimum.e[axis] - lo)/width), 0, n_bins - 1);
+            int b1 = clamp<int>(static_cast<int>((ref.maximum.e[axis] - lo)/width), b0, n_bins - 1);
+            for(int b = b0; b <= b1; b++) {
+                AABB<T> clipped = ref;
+                clipped.minimum.e[axis] = fmax(clipped.minimum.e[axis], lo + b*width);
+                clipped.maximum.e[axis] = fmin(clipped.maximum.e[axis], lo + (b + 1)*width);
+                box[b] = AABB<T>::surrounding_box(box[b], clipped);
+            }
+            enter[b0]++;
+            exit[b1]++;
+        }
+
+        T right_cost[n_bins];
+        size_t right_count[n_bins];
+        AABB<T> acc(inf, -inf);
+        size_t acc_count = 0;
+        for(int b = n_bins - 1; b > 0; b--) {
+            acc = AABB<T>::surrounding_box(acc, box[b]);
+            acc_count += exit[b];
+            right_cost[b - 1] = acc_count ? acc_count*acc.surface_area() : 0;
+            right_count[b - 1] = acc_count;
+        }
+
+        acc = AABB<T>(inf, -inf);
+        acc_count = 0;
+        for(int b = 0; b < n_bins - 1; b++) {
+            acc = AABB<T>::surrounding_box(acc, box[b]);
+            acc_count += enter[b];
+            if(acc_count == 0 || right_count[b] == 0)
+                continue;
+            T cost = SahSplit<T>::traversal_cost + SahSplit<T>::intersection_cost*(acc_count*acc.surface_area() + right_cost[b])/area;
+            if(cost < split.cost) {
+                split.axis = axis;
+                split.position = lo + (b + 1)*width;
+                split.cost = cost;
+                split.duplicates = acc_count + right_count[b] - n;
+            }
+        }
+    }
+
+    return split;
+}
+
+//Build record of one object: its bounds and its position in the source list
+template<class T>
+class BvhPrimitive {
+public:
+    AABB<T> box;
+    Vector3<T> centroid;
+    size_t index;
+    uint32_t morton = 0;
+
+    BvhPrimitive() {}
+    BvhPrimitive(const AABB<T>& _box, size_t _index) : box(_box), centroid(_box.center()), index(_index) {}
+};
+
+//Spreads the low 10 bits of v so there are two zero bits between each of them
+inline uint32_t expand_morton_bits(uint32_t v) {
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+//Sorts prims by the Morton code of their centroids (LSD radix sort, 10 bits per pass)
+template<class T>
+void sort_by_morton(std::vector<BvhPrimitive<T>>& prims) {
+    if(prims.empty())
+        return;
+
+    Vector3<T> lo = prims[0].centroid, hi = prims[0].centroid;
+    for(const auto& p : prims) {
+        for(int i = 0; i < 3; i++) {
+            lo.e[i] = fmin(lo.e[i], p.centroid.e[i]);
+            hi.e[i] = fmax(hi.e[i], p.centroid.e[i]);
+        }
+    }
+
+    constexpr int resolution = 1 << 10;
+    for(auto& p : prims) {
+        uint32_t q[3];
+        for(int i = 0; i < 3; i++) {
+            auto extent = hi.e[i] - lo.e[i];
+            T offset = extent > 0 ? (p.centroid.e[i] - lo.e[i])/extent : 0;
+            q[i] = static_cast<uint32_t>(fmin(offset*resolution, resolution - 1));
+        }
+        //x gets the highest bit of every triple, z the lowest
+        p.morton = (expand_morton_bits(q[0]) << 2) | (expand_morton_bits(q[1]) << 1) | expand_morton_bits(q[2]);
+    }
+
+    std::vector<uint32_t> order(prims.size()), tmp(prims.size());
+    for(size_t i = 0; i < order.size(); i++)
+        order[i] = static_cast<uint32_t>(i);
+
+    constexpr int bits_per_pass = 10;
+    constexpr int buckets = 1 << bits_per_pass;
+    for(int pass = 0; pass < 3; pass++) {
+        int shift = pass*bits_per_pass;
+        size_t count[buckets] = {};
+        for(auto i : order)
+            count[(prims[i].morton >> shift) & (buckets - 1)]++;
+
+        size_t offset = 0;
+        for(int b = 0; b < buckets; b++) {
+            size_t c = count[b];
+            count[b] = offset;
+            offset += c;
+        }
+
+        for(auto i : order)
+            tmp[count[(prims[i].morton >> shift) & (buckets - 1)]++] = i;
+        order.swap(tmp);
+    }
+
+    std::vector<BvhPrimitive<T>> sorted;
+    sorted.reserve(prims.size());
+    for(auto i : order)
+        sorted.push_back(prims[i]);
+    prims.swap(sorted);
+}
+
+//Called once on the whole array before the first partition_primitives
+template<class T>
+void prepare_primitives(std::vector<BvhPrimitive<T>>& prims, BvhSplit split) {
+    if(split == BvhSplit::Morton || split == BvhSplit::HLBVH)
+        sort_by_morton(prims);
+}
+
+//Splits a Morton-sorted range where its highest differing code bit flips
+template<class T>
+size_t morton_split(std::vector<BvhPrimitive<T>>& prims, size_t start, size_t end, int& axis) {
+    uint32_t diff = prims[start].morton ^ prims[end - 1].morton;
+    if(diff == 0) {
+        axis = 0;
+        return start + (end - start)/2;
+    }
+
+    int bit = 31;
+    while(!(diff & (1u << bit)))
+        bit--;
+    axis = 2 - bit % 3;
+
+    auto it = std::partition_point(prims.begin() + start, prims.begin() + end,
+                                   [bit](const BvhPrimitive<T>& p) { return !(p.morton & (1u << bit));});
+    return std::distance(prims.begin(), it);
+}
+
+//HLBVH top levels: SAH over runs of primitives that share the high Morton bits.
+//Runs are moved as a whole, so both halves stay Morton-sorted. Returns start if no split was found.
+template<class T>
+size_t cluster_sah_split(std::vector<BvhPrimitive<T>>& prims, size_t start, size_t end, int& axis) {
+    constexpr int cluster_shift = 18; // 12 high bits select the cluster
+
+    class Cluster {
+    public:
+        size_t begin, end;
+        AABB<T> box;
+    };
+
+    //the range is sorted, so it holds a single cluster if its ends do
+    if((prims[start].morton >> cluster_shift) == (prims[end - 1].morton >> cluster_shift))
+        return start;
+
+    std::vector<Cluster> clusters;
+    for(size_t i = start; i < end; i++) {
+        if(clusters.empty() || (prims[i].morton >> cluster_shift) != (prims[i - 1].morton >> cluster_shift))
+            clusters.push_back(Cluster{i, i, prims[i].box});
+        clusters.back().end = i + 1;
+        clusters.back().box = AABB<T>::surrounding_box(clusters.back().box, prims[i].box);
+    }
+    if(clusters.size() < 2)
+        return start;
+
+    auto sah = find_sah_split<T>(clusters.begin(), clusters.end(), [](const Cluster& c) { return c.box;});
+    if(sah.axis < 0)
+        return start;
+
+    auto mid = std::stable_partition(clusters.begin(), clusters.end(), [&](const Cluster& c) { return sah.goes_left(c.box.center());});
+    if(mid == clusters.begin() || mid == clusters.end())
+        return start;
+
+    std::vector<BvhPrimitive<T>> reordered;
+    reordered.reserve(end - start);
+    size_t split = start;
+    for(auto it = clusters.begin(); it != clusters.end(); ++it) {
+        reordered.insert(reordered.end(), prims.begin() + it->begin, prims.begin() + it->end);
+        if(it + 1 == mid)
+            split = start + reordered.size();
+    }
+    std::copy(reordered.begin(), reordered.end(), prims.begin() + start);
+
+    axis = sah.axis;
+    return split;
+}
+
+//Median split along the widest centroid axis; returns the first index of the right half
+template<class T>
+size_t median_split(std::vector<BvhPrimitive<T>>& prims, size_t start, size_t end, int& axis) {
+    auto first = prims.begin() + start;
+    auto last = prims.begin() + end;
+    size_t span = end - start;
+
+    Vector3<T> lo = first->centroid, hi = first->centroid;
+    for(auto it = first; it != last; ++it) {
+        for(int i = 0; i < 3; i++) {
+            lo.e[i] = fmin(lo.e[i], it->centroid.e[i]);
+            hi.e[i] = fmax(hi.e[i], it->centroid.e[i]);
+        }
+    }
+    auto extent = hi - lo;
+    axis = (extent.x() > extent.y() && extent.x() > extent.z()) ? 0 : (extent.y() > extent.z()) ? 1 : 2;
+
+    auto mid = first + span/2;
+    std::nth_element(first, mid, last, [axis](const BvhPrimitive<T>& a, const BvhPrimitive<T>& b) {
+        return a.centroid.e[axis] < b.centroid.e[axis];
+    });
+
+    return start + span/2;
+}
+
+//Fewest levels a subtree over n primitives can have: halving down to single primitives
+inline int bvh_min_height(size_t n) noexcept {
+    int h = 1;
+    while(n > 1) {
+        n = (n + 1)/2;
+        h++;
+    }
+    return h;
+}
+
+//Trees traversed with a fixed stack are kept to at most max_depth levels. A node at depth
+//(the root is at 0) over n primitives that this returns true for has to become a leaf, if n
+//fits one, or take a median split, which still reaches single primitives in time.
+inline bool bvh_depth_exhausted(int depth, size_t n, int max_depth) noexcept {
+    return depth + bvh_min_height(n) >= max_depth;
+}
+
+//Reorders prims[start, end) in place and returns the first index of the right half,
+//or start if the range should stay a leaf. axis gets the split axis.
+template<class T>
+size_t partition_primitives(std::vector<BvhPrimitive<T>>& prims, size_t start, size_t end, BvhSplit split, int& axis) {
+    size_t span = end - start;
+    axis = 0;
+    if(span <= 1)
+        return start;
+
+    auto first = prims.begin() + start;
+    auto last = prims.begin() + end;
+
+    if(split == BvhSplit::HLBVH) {
+        size_t mid = cluster_sah_split(prims, start, end, axis);
+        if(mid != start)
+            return mid;
+    }
+    if(split == BvhSplit::Morton || split == BvhSplit::HLBVH)
+        return morton_split(prims, start, end, axis);
+
+    if(split == BvhSplit::SAH || split == BvhSplit::SBVH) {
+        auto sah = find_sah_split<T>(first, last, [](const BvhPrimitive<T>& p) { return p.box;});
+        if(sah.make_leaf(span) || (sah.axis < 0 && span <= static_cast<size_t>(SahSplit<T>::max_leaf_size)))
+            return start;
+        if(sah.axis >= 0) {
+            axis = sah.axis;
+            auto mid = std::partition(first, last, [&](const BvhPrimitive<T>& p) { return sah.goes_left(p.centroid);});
+            if(mid != first && mid != last)
+                return std::distance(prims.begin(), mid);
+        }
+    }
+
+    return median_split(prims, start, end, axis);
+}
+//Split for a range whose node is bvh_depth_exhausted: a leaf if it fits one, otherwise halves
+//by the median, or by position for Morton orders so that the ranges below stay sorted
+template<class T>
+size_t depth_limited_split(std::vector<BvhPrimitive<T>>& prims, size_t start, size_t end, BvhSplit split, int& axis) {
+    axis = 0;
+    if(end - start <= static_cast<size_t>(SahSplit<T>::max_leaf_size))
+        return start;
+    if(split == BvhSplit::Morton || split == BvhSplit::HLBVH)
+        return start + (end - start)/2;
+    return median_split(prims, start, end, axis);
+}
+
+//Subtrees are built as separate tasks down to this many levels below the root
+inline int bvh_parallel_depth() {
+    unsigned threads = std::thread::hardware_concurrency();
+    int depth = 0;
+    while((1u << depth) < threads)
+        depth++;
+    return depth + 1;
+}
+
+//Ranges smaller than this are not worth a task of their own
+constexpr size_t bvh_parallel_min_span = 1024;
+
 template<class T>
 class BvhNode : public HittableObject<T> {
 public:
@@ -18,17 +446,20 @@ public:
     AABB<T> box;
 
     BvhNode() {}
-    BvhNode(const std::vector<std::shared_ptr<HittableObject<T>>>& , size_t, size_t, T, T);
-    BvhNode(const HittableList<T>& list, T time0, T time1)
-        : BvhNode(list.objects, 0, list.objects.size() - 1, time0, time1) {}
+    BvhNode(const std::vector<std::shared_ptr<HittableObject<T>>>& , size_t, size_t, T, T, BvhSplit = BvhSplit::Median);
+    BvhNode(const HittableList<T>& list, T time0, T time1, BvhSplit split = BvhSplit::Median)
+        : BvhNode(list.objects, 0, list.objects.size(), time0, time1, split) {}
+    //subtree over prims[start, end), which is partitioned in place
+    BvhNode(const std::vector<std::shared_ptr<HittableObject<T>>>& objects, std::vector<BvhPrimitive<T>>& prims,
+            size_t start, size_t end, BvhSplit split, int depth) { build(objects, prims, start, end, split, depth);}
 
     bool hit(const Ray<T>&, T, T, HitRecord<T>&) const noexcept override;
     bool bounding_box(T, T, AABB<T>&) const override;
 
-    static bool box_compare(std::shared_ptr<HittableObject<T>>, std::shared_ptr<HittableObject<T>>, int);
-    static bool box_x_compare(std::shared_ptr<HittableObject<T>> a, std::shared_ptr<HittableObject<T>> b) {return box_compare(a, b, 0);}
-    static bool box_y_compare(std::shared_ptr<HittableObject<T>> a, std::shared_ptr<HittableObject<T>> b) {return box_compare(a, b, 1);}
-    static bool box_z_compare(std::shared_ptr<HittableObject<T>> a, std::shared_ptr<HittableObject<T>> b) {return box_compare(a, b, 2);}
+private:
+    void build(const std::vector<std::shared_ptr<HittableObject<T>>>&, std::vector<BvhPrimitive<T>>&, size_t, size_t, BvhSplit, int);
+    static std::shared_ptr<HittableObject<T>> make_child(const std::vector<std::shared_ptr<HittableObject<T>>>&,
+                                                         std::vector<BvhPrimitive<T>>&, size_t, size_t, BvhSplit, int);
 };
 
 template<class T>
@@ -43,54 +474,71 @@ bool BvhNode<T>::hit(const Ray<T>& r, T t_min, T t_max, HitRecord<T>& rec) const
         return false;
 
     bool hit_left = left->hit(r, t_min, t_max, rec);
+    if(left == right)
+        return hit_left;
     bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
 
     return hit_left || hit_right;
 }
 
 template<class T>
-bool BvhNode<T>::box_compare(std::shared_ptr<HittableObject<T>> a, std::shared_ptr<HittableObject<T>> b, int axis) {
-    AABB<T> box_a;
-    AABB<T> box_b;
+BvhNode<T>::BvhNode(const std::vector<std::shared_ptr<HittableObject<T>>>& objects,
+                    size_t start, size_t end, T t0, T t1, BvhSplit split) {
+    if(start >= end)
+        throw std::invalid_argument("BvhNode over an empty range");
+
+    std::vector<BvhPrimitive<T>> prims;
+    prims.reserve(end - start);
 
-    assert(a->bounding_box(0, 0, box_a) && b->bounding_box(0, 0, box_b));
+    for(size_t i = start; i < end; i++) {
+        AABB<T> b;
+        if(!objects[i]->bounding_box(t0, t1, b))
+            throw std::invalid_argument("object without bounding box in BvhNode");
+        prims.emplace_back(b, i);
+    }
 
-    return box_a.minimum[axis] < box_b.minimum[axis];
+    prepare_primitives(prims, split);
+    build(objects, prims, 0, prims.size(), split, bvh_parallel_depth());
 }
 
 template<class T>
-BvhNode<T>::BvhNode(const std::vector<std::shared_ptr<HittableObject<T>>>& src_obj,
-                    size_t start, size_t end, T t0, T t1) {
-    auto obj = src_obj;
+std::shared_ptr<HittableObject<T>> BvhNode<T>::make_child(const std::vector<std::shared_ptr<HittableObject<T>>>& objects,
+                                                          std::vector<BvhPrimitive<T>>& prims,
+                                                          size_t start, size_t end, BvhSplit split, int depth) {
+    if(end - start == 1)
+        return objects[prims[start].index];
+    return std::make_shared<BvhNode<T>>(objects, prims, start, end, split, depth);
+}
 
-    int axis = random_int(0, 2);
-    auto comparator = (axis == 0) ? box_x_compare : (axis == 1) ? box_y_compare : box_z_compare;
+template<class T>
+void BvhNode<T>::build(const std::vector<std::shared_ptr<HittableObject<T>>>& objects, std::vector<BvhPrimitive<T>>& prims,
+                       size_t start, size_t end, BvhSplit split, int depth) {
+    box = prims[start].box;
+    for(size_t i = start + 1; i < end; i++)
+        box = AABB<T>::surrounding_box(box, prims[i].box);
 
-    size_t obj_span = end - start;
+    int axis;
+    size_t mid = partition_primitives(prims, start, end, split, axis);
+    int child_depth = depth > 0 ? depth - 1 : 0;
 
-    if(obj_span == 1)
-        left = right = obj[start];
-    else if(obj_span == 2) {
-        if(comparator(obj[start], obj[start + 1])) {
-            left = obj[start];
-            right = obj[start + 1];
+    if(mid == start) {
+        if(end - start == 1) {
+            left = right = objects[prims[start].index];
         } else {
-            left = obj[start + 1];
-            right = obj[start];
+            auto leaf = std::make_shared<HittableList<T>>();
+            for(size_t i = start; i < end; i++)
+                leaf->add(objects[prims[i].index]);
+            left = right = leaf;
         }
+    } else if(depth > 0 && end - start >= bvh_parallel_min_span) {
+        //the halves touch disjoint parts of prims, so the left one can go to another thread
+        auto left_task = std::async(std::launch::async, [&]() {
+            return make_child(objects, prims, start, mid, split, child_depth);
+        });
+        right = make_child(objects, prims, mid, end, split, child_depth);
+        left = left_task.get();
     } else {
-        std::sort(obj.begin() + start, obj.begin() + end, comparator);
-
-        auto mid = start + obj_span/2;
-        left = std::make_shared<BvhNode<T>>(obj, start, mid, t0, t1);
-        right = std::make_shared<BvhNode<T>>(obj, mid, end, t0, t1);
+        left = make_child(objects, prims, start, mid, split, child_depth);
+        right = make_child(objects, prims, mid, end, split, child_depth);
     }
-
-    AABB<T> box_left, box_right;
-
-    assert(left->bounding_box(t0, t1, box_left) && right->bounding_box(t0, t1, box_right));
-
-    box = AABB<T>::surrounding_box(box_left, box_right);
 }
-
-
@@ -6,15 +6,84 @@
 #include "AARect.hpp"
 
 
+//Axis-aligned box hit with one slab test; the face the ray enters, or leaves from inside,
+//gives the normal and the uv, laid out like those of the matching rectangle
 template<class T>
 class Box : public HittableObject<T> {
 public:
     Vector3<T> box_min;
     Vector3<T> box_max;
-    HittableList<T> sides;
+    std::shared_ptr<Material<T>> mp;
 
     Box() {}
-    Box(const Vector3<T>&, const Vector3<T>&, std::shared_ptr<Material<T>>);
+    Box(const Vector3<T>& p0, const Vector3<T>& p1, std::shared_ptr<Material<T>> ptr) : box_min(p0), box_max(p1), mp(ptr) {}
+
+    bool hit(const Ray<T>&, T, T, HitRecord<T>&) const noexcept override;
+    bool bounding_box(T, T, AABB<T>& output_box) const override {
+        output_box = AABB<T>(box_min, box_max);
+        return true;
+    }
+};
+
+template<class T>
+bool Box<T>::hit(const Ray<T>& r, T t_min, T t_max, HitRecord<T>& rec) const noexcept {
+    T t_near = -infinity, t_far = infinity;
+    int near_axis = 0, far_axis = 0;
+
+    for(int a = 0; a < 3; a++) {
+        T inv = 1/r.dir.e[a];
+        T t0 = (box_min.e[a] - r.orig.e[a])*inv;
+        T t1 = (box_max.e[a] - r.orig.e[a])*inv;
+        if(inv < 0)
+            std::swap(t0, t1);
+
+        if(t0 > t_near) {
+            t_near = t0;
+            near_axis = a;
+        }
+        if(t1 < t_far) {
+            t_far = t1;
+            far_axis = a;
+        }
+    }
+    if(t_near > t_far)
+        return false;
+
+    //entry face, or the exit face for rays starting inside
+    bool entering = t_near >= t_min && t_near <= t_max;
+    if(!entering && (t_far < t_min || t_far > t_max))
+        return false;
+    T t = entering ? t_near : t_far;
+    int axis = entering ? near_axis : far_axis;
+
+    rec.t = t;
+    rec.p = r.at(t);
+
+    //outward normal: entering through the min face when moving up the axis
+    Vector3<T> out_norm;
+    bool up = r.dir.e[axis] > 0;
+    out_norm.e[axis] = entering == up ? -1 : 1;
+    rec.set_face_normal(r, out_norm);
+
+    int u_axis = axis == 0 ? 1 : 0;
+    int v_axis = axis == 2 ? 1 : 2;
+    rec.u = (rec.p.e[u_axis] - box_min.e[u_axis])/(box_max.e[u_axis] - box_min.e[u_axis]);
+    rec.v = (rec.p.e[v_axis] - box_min.e[v_axis])/(box_max.e[v_axis] - box_min.e[v_axis]);
+    rec.mat_ptr = mp.get();
+
+    return true;
+}
+
+//The former Box: a list of six rectangles, kept to compare against the slab test
+template<class T>
+class RectBox : public HittableObject<T> {
+public:
+    Vector3<T> box_min;
+    Vector3<T> box_max;
+    HittableList<T> sides;
+
+    RectBox() {}
+    RectBox(const Vector3<T>&, const Vector3<T>&, std::shared_ptr<Material<T>>);
 
     bool hit(const Ray<T>& r, T t0, T t1, HitRecord<T>& rec) const noexcept override { return sides.hit(r, t0, t1, rec);}
     bool bounding_box(T, T, AABB<T>& output_box) const override {
@@ -25,7 +94,7 @@ public:
 };
 
 template<class T>
-Box<T>::Box(const Vector3<T>& p0, const Vector3<T>& p1, std::shared_ptr<Material<T>> ptr) {
+RectBox<T>::RectBox(const Vector3<T>& p0, const Vector3<T>& p1, std::shared_ptr<Material<T>> ptr) {
     box_min = p0;
     box_max = p1;
 
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "HittableObject.hpp"
+#include "HittableList.hpp"
+#include "LinearBVH.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+
+//On-disk LinearBvh: header, flat nodes, then the source index of every primitive in leaf order
+class BvhCacheHeader {
+public:
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;
+    uint64_t scene_hash;
+    uint64_t node_count;
+    uint64_t primitive_count;
+};
+
+constexpr char bvh_cache_magic[8] = {'R', 'T', 'B', 'V', 'H', 'C', 'H', '1'};
+constexpr uint32_t bvh_cache_version = 2;
+
+inline void fnv1a(uint64_t& hash, const void* data, size_t size) {
+    auto bytes = static_cast<const unsigned char*>(data);
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+//Hash of what a build depends on: object types and bounds, shutter interval and split strategy
+template<class T>
+uint64_t scene_hash(const std::vector<std::shared_ptr<HittableObject<T>>>& objects, T t0, T t1, BvhSplit split) {
+    uint64_t hash = 14695981039346656037ull;
+    uint64_t count = objects.size();
+    int32_t strategy = static_cast<int32_t>(split);
+    fnv1a(hash, &count, sizeof(count));
+    fnv1a(hash, &strategy, sizeof(strategy));
+    fnv1a(hash, &t0, sizeof(t0));
+    fnv1a(hash, &t1, sizeof(t1));
+
+    for(const auto& obj : objects) {
+        const char* type = typeid(*obj).name();
+        fnv1a(hash, type, std::strlen(type));
+
+        AABB<T> box;
+        if(obj->bounding_box(t0, t1, box)) {
+            fnv1a(hash, box.minimum.e, 3*sizeof(T));
+            fnv1a(hash, box.maximum.e, 3*sizeof(T));
+        }
+    }
+    return hash;
+}
+
+template<class T>
+bool save_bvh(const std::string& path, const LinearBvh<T>& bvh,
+              const std::vector<std::shared_ptr<HittableObject<T>>>& objects, uint64_t hash) {
+    std::unordered_map<const HittableObject<T>*, uint32_t> source;
+    for(size_t i = 0; i < objects.size(); i++)
+        source.emplace(objects[i].get(), static_cast<uint32_t>(i));
+
+    std::vector<uint32_t> order;
+    order.reserve(bvh.primitives.size());
+    for(const auto& p : bvh.primitives) {
+        auto it = source.find(p.get());
+        if(it == source.end())
+            return false;
+        order.push_back(it->second);
+    }
+
+    BvhCacheHeader header;
+    std::memcpy(header.magic, bvh_cache_magic, sizeof(header.magic));
+    header.version = bvh_cache_version;
+    header.node_size = sizeof(LinearBvhNode);
+    header.scene_hash = hash;
+    header.node_count = bvh.nodes.size();
+    header.primitive_count = order.size();
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if(!out)
+        return false;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(bvh.nodes.data()), bvh.nodes.size()*sizeof(LinearBvhNode));
+    out.write(reinterpret_cast<const char*>(order.data()), order.size()*sizeof(uint32_t));
+    return static_cast<bool>(out);
+}
+
+//Fills bvh from path if the file was written for this scene; any mismatch or damage returns false
+template<class T>
+bool load_bvh(const std::string& path, LinearBvh<T>& bvh,
+              const std::vector<std::shared_ptr<HittableObject<T>>>& objects, uint64_t hash, BvhSplit split) {
+    //nodes and order are read straight into the arrays the tree keeps
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if(!in)
+        return false;
+    auto file_size = static_cast<uint64_t>(in.tellg());
+    if(file_size < sizeof(BvhCacheHeader))
+        return false;
+    in.seekg(0);
+
+    BvhCacheHeader header;
+    if(!in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+        return false;
+    if(std::memcmp(header.magic, bvh_cache_magic, sizeof(header.magic)) != 0 || header.version != bvh_cache_version ||
+       header.node_size != sizeof(LinearBvhNode) || header.scene_hash != hash)
+        return false;
+
+    //counts are checked against the file size before anything is allocated for them
+    if(header.node_count > file_size/sizeof(LinearBvhNode) || header.primitive_count > file_size/sizeof(uint32_t))
+        return false;
+    uint64_t expected = sizeof(header) + header.node_count*sizeof(LinearBvhNode) + header.primitive_count*sizeof(uint32_t);
+    if(file_size != expected)
+        return false;
+
+    LinearBvhNodes nodes(header.node_count);
+    std::vector<uint32_t> order(header.primitive_count);
+    if(!in.read(reinterpret_cast<char*>(nodes.data()), nodes.size()*sizeof(LinearBvhNode)) ||
+       !in.read(reinterpret_cast<char*>(order.data()), order.size()*sizeof(uint32_t)))
+        return false;
+
+    std::vector<std::shared_ptr<HittableObject<T>>> primitives;
+    primitives.reserve(order.size());
+    for(auto index : order) {
+        if(index >= objects.size())
+            return false;
+        primitives.push_back(objects[index]);
+    }
+
+    for(size_t i = 0; i < nodes.size(); i++) {
+        const auto& n = nodes[i];
+        bool inner_ok = n.count == 0 && n.axis < 3 && n.offset > static_cast<int32_t>(i) && static_cast<size_t>(n.offset) + 1 < nodes.size();
+        bool leaf_ok = n.count > 0 && n.offset >= 0 && static_cast<size_t>(n.offset) + n.count <= primitives.size();
+        if(!inner_ok && !leaf_ok)
+            return false;
+    }
+    //forward offsets still allow shared or orphaned nodes; it has to be one tree that fits the traversal stack
+    int height = bvh_tree_height(nodes);
+    if(height < 0 || height > LinearBvh<T>::max_depth)
+        return false;
+
+    bvh.nodes.swap(nodes);
+    bvh.primitives.swap(primitives);
+    bvh.compiled = compile_primitives(bvh.primitives);
+    bvh.split = split;
+    bvh.built_cost = bvh.sah_cost();
+    return true;
+}
+
+//LinearBvh that is read from path when it matches the scene, and built and written there otherwise
+template<class T>
+std::shared_ptr<LinearBvh<T>> cached_bvh(const std::string& path, const HittableList<T>& list, T t0, T t1,
+                                         BvhSplit split = BvhSplit::SAH) {
+    auto hash = scene_hash(list.objects, t0, t1, split);
+
+    auto bvh = std::make_shared<LinearBvh<T>>();
+    if(load_bvh(path, *bvh, list.objects, hash, split))
+        return bvh;
+
+    bvh = std::make_shared<LinearBvh<T>>(list, t0, t1, split);
+    save_bvh(path, *bvh, list.objects, hash);
+    return bvh;
+}
@@ -21,7 +21,7 @@ template<typename T>
 T random(T min, T max) {
     static std::random_device rd;
     static thread_local std::default_random_engine generator(rd());
-    static std::uniform_real_distribution < T > distribution(min, max);
+    std::uniform_real_distribution < T > distribution(min, max);
     return distribution(generator);
 }
 
@@ -15,7 +15,7 @@ class HitRecord {
 public:
     Vector3<T> p;
     Vector3<T> normal;
-    std::shared_ptr<Material<T>> mat_ptr;
+    const Material<T>* mat_ptr = nullptr; // owned by the object that was hit
     T t;
     T u, v;
     bool front_face;
@@ -96,8 +96,8 @@ public:
                     Vector3<T> tmp(newx, y, newz);
 
                     for(int c = 0; c < 3; c++) {
-                        min[c] = fmin(min[c], tmp[c]);
-                        max[c] = fmax(max[c], tmp[c]);
+                        min.e[c] = fmin(min.e[c], tmp.e[c]);
+                        max.e[c] = fmax(max.e[c], tmp.e[c]);
                     }
                 }
             }
@@ -115,11 +115,11 @@ public:
         auto origin = r.orig;
         auto direction = r.dir;
 
-        origin[0] = cos_theta*r.orig[0] - sin_theta*r.orig[2];
-        origin[2] = sin_theta*r.orig[0] + cos_theta*r.orig[2];
+        origin.x() = cos_theta*r.orig.x() - sin_theta*r.orig.z();
+        origin.z() = sin_theta*r.orig.x() + cos_theta*r.orig.z();
 
-        direction[0] = cos_theta*r.dir[0] - sin_theta*r.dir[2];
-        direction[2] = sin_theta*r.dir[0] + cos_theta*r.dir[2];
+        direction.x() = cos_theta*r.dir.x() - sin_theta*r.dir.z();
+        direction.z() = sin_theta*r.dir.x() + cos_theta*r.dir.z();
 
         Ray<T> rotated(origin, direction, r.time);
 
@@ -129,11 +129,11 @@ public:
         auto p = rec.p;
         auto normal = rec.normal;
 
-        p[0] =  cos_theta*rec.p[0] + sin_theta*rec.p[2];
-        p[2] = -sin_theta*rec.p[0] + cos_theta*rec.p[2];
+        p.x() =  cos_theta*rec.p.x() + sin_theta*rec.p.z();
+        p.z() = -sin_theta*rec.p.x() + cos_theta*rec.p.z();
 
-        normal[0] =  cos_theta*rec.normal[0] + sin_theta*rec.normal[2];
-        normal[2] = -sin_theta*rec.normal[0] + cos_theta*rec.normal[2];
+        normal.x() =  cos_theta*rec.normal.x() + sin_theta*rec.normal.z();
+        normal.z() = -sin_theta*rec.normal.x() + cos_theta*rec.normal.z();
 
         rec.p = p;
         rec.set_face_normal(rotated, normal);
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "General.hpp"
+#include "HittableObject.hpp"
+#include "LinearBVH.hpp"
+#include "AABB.hpp"
+#include "Ray.hpp"
+
+#include <memory>
+#include <cmath>
+#include <stdexcept>
+
+
+//Affine transform stored together with its inverse, rows are [linear part | translation]
+template<class T>
+class Transform {
+public:
+    T m[3][4];   // object to world
+    T inv[3][4]; // world to object
+
+    Transform() noexcept {
+        for(int r = 0; r < 3; r++)
+            for(int c = 0; c < 4; c++)
+                m[r][c] = inv[r][c] = (r == c) ? 1 : 0;
+    }
+
+    static Transform translate(const Vector3<T>& offset) noexcept {
+        Transform t;
+        for(int r = 0; r < 3; r++) {
+            t.m[r][3] = offset.e[r];
+            t.inv[r][3] = -offset.e[r];
+        }
+        return t;
+    }
+
+    //same convention as RotateY
+    static Transform rotate_y(T angle) noexcept {
+        Transform t;
+        T s = sin(degrees_to_radians(angle));
+        T c = cos(degrees_to_radians(angle));
+        t.m[0][0] = c;  t.m[0][2] = s;
+        t.m[2][0] = -s; t.m[2][2] = c;
+        t.inv[0][0] = c; t.inv[0][2] = -s;
+        t.inv[2][0] = s; t.inv[2][2] = c;
+        return t;
+    }
+
+    static Transform scale(const Vector3<T>& s) {
+        if(s.x() == 0 || s.y() == 0 || s.z() == 0)
+            throw std::invalid_argument("zero scale in Transform");
+        Transform t;
+        for(int r = 0; r < 3; r++) {
+            t.m[r][r] = s.e[r];
+            t.inv[r][r] = 1/s.e[r];
+        }
+        return t;
+    }
+
+    //a*b applies b first
+    friend Transform operator*(const Transform& a, const Transform& b) noexcept {
+        Transform t;
+        compose(a.m, b.m, t.m);
+        compose(b.inv, a.inv, t.inv);
+        return t;
+    }
+
+    Vector3<T> point(const Vector3<T>& p) const noexcept { return apply(m, p, 1);}
+    Vector3<T> vector(const Vector3<T>& v) const noexcept { return apply(m, v, 0);}
+    Vector3<T> inv_point(const Vector3<T>& p) const noexcept { return apply(inv, p, 1);}
+    Vector3<T> inv_vector(const Vector3<T>& v) const noexcept { return apply(inv, v, 0);}
+
+    //normals go through the inverse transpose
+    Vector3<T> normal(const Vector3<T>& n) const noexcept {
+        return Vector3<T>(inv[0][0]*n.e[0] + inv[1][0]*n.e[1] + inv[2][0]*n.e[2],
+                          inv[0][1]*n.e[0] + inv[1][1]*n.e[1] + inv[2][1]*n.e[2],
+                          inv[0][2]*n.e[0] + inv[1][2]*n.e[1] + inv[2][2]*n.e[2]);
+    }
+
+    AABB<T> box(const AABB<T>& b) const noexcept {
+        Vector3<T> lo, hi;
+        for(int r = 0; r < 3; r++) {
+            lo.e[r] = hi.e[r] = m[r][3];
+            for(int c = 0; c < 3; c++) {
+                T a = m[r][c]*b.minimum.e[c];
+                T d = m[r][c]*b.maximum.e[c];
+                lo.e[r] += fmin(a, d);
+                hi.e[r] += fmax(a, d);
+            }
+        }
+        return AABB<T>(lo, hi);
+    }
+
+private:
+    static Vector3<T> apply(const T (&a)[3][4], const Vector3<T>& v, T w) noexcept {
+        return Vector3<T>(a[0][0]*v.e[0] + a[0][1]*v.e[1] + a[0][2]*v.e[2] + w*a[0][3],
+                          a[1][0]*v.e[0] + a[1][1]*v.e[1] + a[1][2]*v.e[2] + w*a[1][3],
+                          a[2][0]*v.e[0] + a[2][1]*v.e[1] + a[2][2]*v.e[2] + w*a[2][3]);
+    }
+
+    static void compose(const T (&a)[3][4], const T (&b)[3][4], T (&out)[3][4]) noexcept {
+        for(int r = 0; r < 3; r++) {
+            for(int c = 0; c < 4; c++) {
+                out[r][c] = a[r][0]*b[0][c] + a[r][1]*b[1][c] + a[r][2]*b[2][c];
+                if(c == 3)
+                    out[r][c] += a[r][3];
+            }
+        }
+    }
+};
+
+//One placement of a shared bottom-level structure (usually a LinearBvh over a mesh or a group).
+//Many instances can point at the same blas, only the transform is stored per copy.
+template<class T>
+class Instance : public HittableObject<T> {
+public:
+    std::shared_ptr<HittableObject<T>> blas;
+    Transform<T> transform;
+    AABB<T> bbox;
+    bool has_box;
+
+    Instance() {}
+    Instance(std::shared_ptr<HittableObject<T>> _blas, const Transform<T>& _transform)
+        : blas(_blas), transform(_transform) {
+        AABB<T> local;
+        has_box = blas->bounding_box(0, 1, local);
+        if(has_box)
+            bbox = transform.box(local);
+    }
+
+    bool bounding_box(T, T, AABB<T>& out) const override {
+        out = bbox;
+        return has_box;
+    }
+
+    bool hit(const Ray<T>& r, T t0, T t1, HitRecord<T>& rec) const noexcept override {
+        //the object space direction is not normalized, so t is the same in both spaces
+        Ray<T> local(transform.inv_point(r.orig), transform.inv_vector(r.dir), r.time);
+
+        if(!blas->hit(local, t0, t1, rec))
+            return false;
+
+        //front_face is kept: the inverse transpose preserves the sign of dot(dir, normal)
+        rec.p = transform.point(rec.p);
+        rec.normal = transform.normal(rec.normal).unit();
+
+        return true;
+    }
+};
+
+//The top level is a LinearBvh built over Instance objects
+template<class T>
+using Tlas = LinearBvh<T>;
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "General.hpp"
+#include "HittableObject.hpp"
+#include "Materials.hpp"
+#include "Ray.hpp"
+
+#include <algorithm>
+
+
+//Bounces before Russian roulette may end a path
+constexpr int default_roulette_depth = 3;
+
+//Russian roulette: a path survives with probability equal to its largest throughput
+//channel and survivors are reweighted, so the estimate stays unbiased while paths that
+//can no longer contribute much stop early. Returns false when the path ends.
+template<class T>
+bool russian_roulette(Vector3<T>& throughput) {
+    T survive = std::min<T>(std::max(throughput.x(), std::max(throughput.y(), throughput.z())), 1);
+    if(survive <= 0 || random<T>(0, 1) >= survive)
+        return false;
+    throughput = throughput/survive;
+    return true;
+}
+
+//Iterative path tracer: follows r for at most max_depth hits, carrying the product of the
+//attenuations as throughput instead of recursing. sky(ray) is the radiance of rays leaving
+//the scene. With first_hit the first intersection is taken as already known (e.g. from a packet).
+template<class T, class Sky>
+Vector3<T> path_radiance(Ray<T> r, const HittableObject<T>& world, const Sky& sky, int max_depth,
+                         const HitRecord<T>* first_hit = nullptr, int roulette_depth = default_roulette_depth) {
+    Vector3<T> radiance(0, 0, 0);
+    Vector3<T> throughput(1, 1, 1);
+    HitRecord<T> rec;
+
+    for(int bounce = 0; bounce < max_depth; bounce++) {
+        if(bounce == 0 && first_hit) {
+            rec = *first_hit;
+        } else if(!world.hit(r, 0.0001, infinity, rec)) {
+            radiance += throughput*sky(r);
+            break;
+        }
+
+        radiance += throughput*material_emitted(*rec.mat_ptr, rec.u, rec.v, rec.p);
+
+        Ray<T> scattered;
+        Vector3<T> attenuation;
+        if(!material_scatter(*rec.mat_ptr, r, rec, attenuation, scattered))
+            break;
+
+        throughput = throughput*attenuation;
+        r = scattered;
+
+        if(bounce + 1 >= roulette_depth && !russian_roulette(throughput))
+            break;
+    }
+
+    return radiance;
+}
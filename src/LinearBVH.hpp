@@ -0,0 +1,645 @@
+#pragma once
+
+#include "General.hpp"
+#include "HittableObject.hpp"
+#include "HittableList.hpp"
+#include "BVH.hpp"
+#include "Primitive.hpp"
+#include "AABB.hpp"
+#include "Ray.hpp"
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <future>
+#include <algorithm>
+
+
+//float bounds that never shrink the box they were made from
+template<class T>
+AABB<float> conservative_box(const AABB<T>& b) {
+    AABB<float> out;
+    for(int i = 0; i < 3; i++) {
+        float lo = static_cast<float>(b.minimum.e[i]);
+        float hi = static_cast<float>(b.maximum.e[i]);
+        if(lo > b.minimum.e[i])
+            lo = std::nextafter(lo, -std::numeric_limits<float>::infinity());
+        if(hi < b.maximum.e[i])
+            hi = std::nextafter(hi, std::numeric_limits<float>::infinity());
+        out.minimum.e[i] = lo;
+        out.maximum.e[i] = hi;
+    }
+    return out;
+}
+
+//Slab test of a box against a ray given by its origin and inverse direction
+template<class B, class T>
+bool slab_hit(const AABB<B>& box, const Vector3<T>& orig, const Vector3<T>& inv_dir, T t_min, T t_max) noexcept {
+    for(int i = 0; i < 3; i++) {
+        T t0 = (box.minimum.e[i] - orig.e[i])*inv_dir.e[i];
+        T t1 = (box.maximum.e[i] - orig.e[i])*inv_dir.e[i];
+        if(inv_dir.e[i] < 0)
+            std::swap(t0, t1);
+
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+
+        if(t_min > t_max)
+            return false;
+    }
+    return true;
+}
+
+//Node of the flattened tree. The two children of an interior node are stored next to
+//each other at offset and offset + 1, always after their parent.
+class alignas(32) LinearBvhNode {
+public:
+    AABB<float> box;
+    int32_t offset;  // first primitive for leaves, first of the two children for interior nodes
+    uint16_t count;  // number of primitives, 0 for interior nodes
+    uint8_t axis;
+    uint8_t pad;
+
+    template<class T>
+    bool hit(const Vector3<T>& orig, const Vector3<T>& inv_dir, T t_min, T t_max) const noexcept {
+        return slab_hit(box, orig, inv_dir, t_min, t_max);
+    }
+};
+
+static_assert(sizeof(LinearBvhNode) == 32, "LinearBvhNode should fill half a cache line");
+
+//Places node arrays half a cache line past a line boundary: the root then sits alone at
+//the end of the first line and every sibling pair after it shares one line
+template<class N>
+class SiblingPairAllocator {
+public:
+    using value_type = N;
+
+    SiblingPairAllocator() noexcept {}
+    template<class U>
+    SiblingPairAllocator(const SiblingPairAllocator<U>&) noexcept {}
+
+    N* allocate(size_t n) {
+        char* raw = static_cast<char*>(::operator new(n*sizeof(N) + 128));
+        uintptr_t line = (reinterpret_cast<uintptr_t>(raw) + sizeof(void*) + 63) & ~uintptr_t(63);
+        char* p = reinterpret_cast<char*>(line) + 32;
+        reinterpret_cast<void**>(p)[-1] = raw;
+        return reinterpret_cast<N*>(p);
+    }
+    void deallocate(N* p, size_t) noexcept {
+        ::operator delete(reinterpret_cast<void**>(p)[-1]);
+    }
+
+    template<class U>
+    bool operator==(const SiblingPairAllocator<U>&) const noexcept { return true;}
+    template<class U>
+    bool operator!=(const SiblingPairAllocator<U>&) const noexcept { return false;}
+};
+
+using LinearBvhNodes = std::vector<LinearBvhNode, SiblingPairAllocator<LinearBvhNode>>;
+
+//Levels of the flattened tree rooted at nodes[0], 1 for a lone leaf and 0 for no nodes. -1 if
+//the array is not one tree: a child index out of range, or a node reached twice or never.
+template<class Nodes>
+int bvh_tree_height(const Nodes& nodes) {
+    if(nodes.empty())
+        return 0;
+
+    std::vector<char> reached(nodes.size(), 0);
+    std::vector<std::pair<size_t, int>> pending = {{0, 1}}; // node and its level
+    size_t visited = 0;
+    int height = 0;
+    while(!pending.empty()) {
+        auto top = pending.back();
+        pending.pop_back();
+        if(reached[top.first])
+            return -1;
+        reached[top.first] = 1;
+        visited++;
+        height = std::max(height, top.second);
+
+        const auto& node = nodes[top.first];
+        if(node.count > 0)
+            continue;
+        if(node.offset < 0 || static_cast<size_t>(node.offset) + 1 >= nodes.size())
+            return -1;
+        pending.emplace_back(node.offset, top.second + 1);
+        pending.emplace_back(node.offset + 1, top.second + 1);
+    }
+    return visited == nodes.size() ? height : -1;
+}
+
+//Node order written by LinearBvh::reorder. Treelet lays out small breadth-first
+//blocks of treelet_depth levels, and places the blocks below them depth-first.
+enum class BvhLayout { DepthFirst, BreadthFirst, Treelet };
+
+template<class T>
+class LinearBvh : public HittableObject<T> {
+public:
+    static constexpr int max_depth = 64;
+    static constexpr int treelet_depth = 3;
+    static constexpr size_t cache_line_bytes = 64;
+
+    std::vector<std::shared_ptr<HittableObject<T>>> primitives; // in leaf order
+    std::vector<Primitive<T>> compiled; // primitives as leaves intersect them, refreshed by refit
+    LinearBvhNodes nodes;
+    BvhSplit split = BvhSplit::SAH;
+    T built_cost = 0; // sah_cost() right after the last full build
+
+    LinearBvh() {}
+    LinearBvh(const std::vector<std::shared_ptr<HittableObject<T>>>&, T, T, BvhSplit = BvhSplit::SAH);
+    LinearBvh(const HittableList<T>& list, T time0, T time1, BvhSplit split = BvhSplit::SAH)
+        : LinearBvh(list.objects, time0, time1, split) {}
+
+    bool hit(const Ray<T>&, T, T, HitRecord<T>&) const noexcept override;
+    bool bounding_box(T, T, AABB<T>&) const override;
+
+    //Recomputes node bounds bottom-up for objects that moved, the topology is kept
+    void refit(T, T);
+    //Expected cost of a ray query, in units of one primitive intersection
+    T sah_cost() const;
+    //Refits, or rebuilds once the refitted tree costs max_cost_ratio times a fresh one. Returns true on rebuild.
+    bool update(T, T, T max_cost_ratio = 1.5);
+
+    //Rewrites the nodes in another memory order; rotation_passes > 0 first restructures
+    //the tree with child/grandchild swaps that lower its SAH cost. Primitives are not moved.
+    void reorder(BvhLayout, int rotation_passes = 0);
+    //Average number of distinct blocks of node memory a query touches, for comparing layouts.
+    //With the default 64 bytes every sibling pair is one line, larger blocks show prefetch and page locality.
+    T cache_lines_per_ray(const std::vector<Ray<T>>&, T, T, size_t line_bytes = cache_line_bytes) const;
+
+private:
+    template<class Visit>
+    bool traverse(const Ray<T>&, T, T, HitRecord<T>&, Visit&&) const noexcept;
+
+    static int rotate(LinearBvhNodes&, std::vector<std::pair<int, int>>&, int, int);
+    static void orient(LinearBvhNodes&, std::vector<std::pair<int, int>>&, int);
+
+    static void build(std::vector<BvhPrimitive<T>>&, size_t, size_t, BvhSplit, LinearBvhNodes&, int, int, int);
+    static void build_spatial(std::vector<BvhPrimitive<T>>&, LinearBvhNodes&, std::vector<size_t>&, size_t&, T, int, int);
+};
+
+template<class T>
+LinearBvh<T>::LinearBvh(const std::vector<std::shared_ptr<HittableObject<T>>>& objects, T t0, T t1, BvhSplit _split) : split(_split) {
+    std::vector<BvhPrimitive<T>> prims;
+    prims.reserve(objects.size());
+
+    for(size_t i = 0; i < objects.size(); i++) {
+        AABB<T> b;
+        if(!objects[i]->bounding_box(t0, t1, b))
+            throw std::invalid_argument("object without bounding box in LinearBvh");
+        prims.emplace_back(b, i);
+    }
+
+    if(prims.empty())
+        return;
+
+    if(split == BvhSplit::SBVH) {
+        //references to straddling objects are duplicated, so the leaf order is collected separately
+        std::vector<size_t> order;
+        size_t budget = static_cast<size_t>(SpatialSplit<T>::max_duplication*prims.size());
+        AABB<T> root = prims[0].box;
+        for(const auto& p : prims)
+            root = AABB<T>::surrounding_box(root, p.box);
+
+        nodes.emplace_back();
+        build_spatial(prims, nodes, order, budget, root.surface_area(), 0, 0);
+
+        primitives.reserve(order.size());
+        for(auto i : order)
+            primitives.push_back(objects[i]);
+    } else {
+        prepare_primitives(prims, split);
+        nodes.reserve(2*prims.size() - 1);
+        nodes.emplace_back();
+        build(prims, 0, prims.size(), split, nodes, 0, 0, bvh_parallel_depth());
+
+        primitives.reserve(prims.size());
+        for(const auto& p : prims)
+            primitives.push_back(objects[p.index]);
+    }
+
+    if(bvh_tree_height(nodes) > max_depth)
+        throw std::logic_error("LinearBvh built deeper than its traversal stack");
+
+    compiled = compile_primitives(primitives);
+    built_cost = sah_cost();
+}
+
+//Fills out[idx], which sits at depth, with the subtree over prims[start, end); children are
+//appended as a pair. The top parallel levels are built on separate threads.
+template<class T>
+void LinearBvh<T>::build(std::vector<BvhPrimitive<T>>& prims, size_t start, size_t end, BvhSplit split,
+                         LinearBvhNodes& out, int idx, int depth, int parallel) {
+    AABB<T> box = prims[start].box;
+    for(size_t i = start + 1; i < end; i++)
+        box = AABB<T>::surrounding_box(box, prims[i].box);
+
+    int axis;
+    size_t mid = bvh_depth_exhausted(depth, end - start, max_depth) ? depth_limited_split(prims, start, end, split, axis)
+                                                                     : partition_primitives(prims, start, end, split, axis);
+    int child_parallel = parallel > 0 ? parallel - 1 : 0;
+
+    out[idx].box = conservative_box(box);
+    out[idx].axis = static_cast<uint8_t>(axis);
+
+    if(mid == start) {
+        out[idx].offset = static_cast<int32_t>(start);
+        out[idx].count = static_cast<uint16_t>(end - start);
+        return;
+    }
+
+    int first = static_cast<int>(out.size());
+    out[idx].offset = first;
+    out[idx].count = 0;
+    out.resize(out.size() + 2);
+
+    if(parallel > 0 && end - start >= bvh_parallel_min_span) {
+        //the right subtree is built into its own array on another thread and spliced in after the left one
+        LinearBvhNodes right_nodes(1);
+        auto right_task = std::async(std::launch::async, [&]() {
+            right_nodes.reserve(2*(end - mid));
+            build(prims, mid, end, split, right_nodes, 0, depth + 1, child_parallel);
+        });
+        build(prims, start, mid, split, out, first, depth + 1, child_parallel);
+        right_task.get();
+
+        //its root takes the reserved slot, everything else is appended
+        int base = static_cast<int>(out.size()) - 1;
+        for(auto& node : right_nodes) {
+            if(node.count == 0)
+                node.offset += base;
+        }
+        out[first + 1] = right_nodes[0];
+        out.insert(out.end(), right_nodes.begin() + 1, right_nodes.end());
+    } else {
+        build(prims, start, mid, split, out, first, depth + 1, child_parallel);
+        build(prims, mid, end, split, out, first + 1, depth + 1, child_parallel);
+    }
+}
+
+//SBVH: refs hold clipped boxes; each call either splits them by objects or by a plane
+//that duplicates straddling refs, while the duplication budget lasts
+template<class T>
+void LinearBvh<T>::build_spatial(std::vector<BvhPrimitive<T>>& refs, LinearBvhNodes& out,
+                                 std::vector<size_t>& order, size_t& budget, T root_area, int idx, int depth) {
+    AABB<T> box = refs[0].box;
+    for(const auto& r : refs)
+        box = AABB<T>::surrounding_box(box, r.box);
+    out[idx].box = conservative_box(box);
+
+    auto box_of = [](const BvhPrimitive<T>& p) { return p.box;};
+    auto object = find_sah_split<T>(refs.begin(), refs.end(), box_of);
+
+    std::vector<BvhPrimitive<T>> left, right;
+    int axis = object.axis;
+    //near the depth limit only a median split still reaches single references in time
+    const bool exhausted = bvh_depth_exhausted(depth, refs.size(), max_depth);
+
+    if(!exhausted && !object.make_leaf(refs.size()) && depth < max_depth/2) {
+        T overlap_area = 0;
+        if(object.axis >= 0) {
+            const Vector3<T> inf(infinity, infinity, infinity);
+            AABB<T> lb(inf, -inf), rb(inf, -inf);
+            for(const auto& r : refs) {
+                if(object.goes_left(r.centroid))
+                    lb = AABB<T>::surrounding_box(lb, r.box);
+                else
+                    rb = AABB<T>::surrounding_box(rb, r.box);
+            }
+            Vector3<T> lo(fmax(lb.minimum.x(), rb.minimum.x()), fmax(lb.minimum.y(), rb.minimum.y()), fmax(lb.minimum.z(), rb.minimum.z()));
+            Vector3<T> hi(fmin(lb.maximum.x(), rb.maximum.x()), fmin(lb.maximum.y(), rb.maximum.y()), fmin(lb.maximum.z(), rb.maximum.z()));
+            if(lo.x() <= hi.x() && lo.y() <= hi.y() && lo.z() <= hi.z())
+                overlap_area = AABB<T>(lo, hi).surface_area();
+        }
+
+        if(object.axis < 0 || overlap_area > SpatialSplit<T>::min_overlap*root_area) {
+            auto spatial = find_spatial_split<T>(refs.begin(), refs.end(), box, box_of);
+            if(spatial.axis >= 0 && spatial.cost < object.cost && spatial.duplicates <= budget) {
+                for(const auto& r : refs) {
+                    if(r.box.maximum.e[spatial.axis] <= spatial.position) {
+                        left.push_back(r);
+                    } else if(r.box.minimum.e[spatial.axis] >= spatial.position) {
+                        right.push_back(r);
+                    } else {
+                        AABB<T> lb = r.box, rb = r.box;
+                        lb.maximum.e[spatial.axis] = spatial.position;
+                        rb.minimum.e[spatial.axis] = spatial.position;
+                        left.emplace_back(lb, r.index);
+                        right.emplace_back(rb, r.index);
+                    }
+                }
+                //the binned estimate can undercount refs that touch the plane, so the budget is
+                //checked again against the real duplicates
+                size_t duplicates = left.size() + right.size() - refs.size();
+                if(left.empty() || right.empty() || (left.size() == refs.size() && right.size() == refs.size())
+                   || duplicates > budget) {
+                    left.clear();
+                    right.clear();
+                } else {
+                    budget -= duplicates;
+                    axis = spatial.axis;
+                }
+            }
+        }
+    }
+
+    if(left.empty() && !exhausted && object.axis >= 0 && !object.make_leaf(refs.size())) {
+        for(const auto& r : refs)
+            (object.goes_left(r.centroid) ? left : right).push_back(r);
+        if(left.empty() || right.empty()) {
+            left.clear();
+            right.clear();
+        }
+    }
+
+    if(left.empty() && refs.size() > static_cast<size_t>(SahSplit<T>::max_leaf_size)) {
+        //nothing better than halving, e.g. all centroids coincide
+        size_t mid = median_split(refs, 0, refs.size(), axis);
+        left.assign(refs.begin(), refs.begin() + mid);
+        right.assign(refs.begin() + mid, refs.end());
+    }
+
+    if(left.empty()) {
+        out[idx].offset = static_cast<int32_t>(order.size());
+        out[idx].count = static_cast<uint16_t>(refs.size());
+        out[idx].axis = 0;
+        for(const auto& r : refs)
+            order.push_back(r.index);
+        return;
+    }
+
+    int first = static_cast<int>(out.size());
+    out[idx].offset = first;
+    out[idx].count = 0;
+    out[idx].axis = static_cast<uint8_t>(axis);
+    out.resize(out.size() + 2);
+
+    refs.clear();
+    refs.shrink_to_fit();
+    build_spatial(left, out, order, budget, root_area, first, depth + 1);
+    build_spatial(right, out, order, budget, root_area, first + 1, depth + 1);
+}
+
+template<class T>
+void LinearBvh<T>::refit(T t0, T t1) {
+    //children always come after their parent in the array
+    for(int i = static_cast<int>(nodes.size()) - 1; i >= 0; i--) {
+        auto& node = nodes[i];
+        if(node.count > 0) {
+            AABB<T> box, tmp;
+            primitives[node.offset]->bounding_box(t0, t1, box);
+            for(int p = 1; p < node.count; p++) {
+                primitives[node.offset + p]->bounding_box(t0, t1, tmp);
+                box = AABB<T>::surrounding_box(box, tmp);
+            }
+            node.box = conservative_box(box);
+        } else {
+            node.box = AABB<float>::surrounding_box(nodes[node.offset].box, nodes[node.offset + 1].box);
+        }
+    }
+    compiled = compile_primitives(primitives);
+}
+
+template<class T>
+T LinearBvh<T>::sah_cost() const {
+    if(nodes.empty())
+        return 0;
+
+    T root_area = nodes[0].box.surface_area();
+    if(root_area <= 0)
+        return 0;
+
+    T cost = 0;
+    for(const auto& node : nodes) {
+        T weight = node.count > 0 ? node.count*SahSplit<T>::intersection_cost : SahSplit<T>::traversal_cost;
+        cost += weight*node.box.surface_area()/root_area;
+    }
+    return cost;
+}
+
+template<class T>
+bool LinearBvh<T>::update(T t0, T t1, T max_cost_ratio) {
+    refit(t0, t1);
+    if(sah_cost() <= max_cost_ratio*built_cost)
+        return false;
+
+    auto objects = primitives;
+    if(split == BvhSplit::SBVH) {
+        std::sort(objects.begin(), objects.end());
+        objects.erase(std::unique(objects.begin(), objects.end()), objects.end());
+    }
+    *this = LinearBvh<T>(objects, t0, t1, split);
+    return true;
+}
+
+template<class T>
+void LinearBvh<T>::reorder(BvhLayout layout, int rotation_passes) {
+    if(nodes.size() < 3)
+        return;
+
+    //work on explicit child links so subtrees can move freely
+    LinearBvhNodes tree = nodes;
+    std::vector<std::pair<int, int>> kids(nodes.size(), {-1, -1});
+    for(size_t i = 0; i < nodes.size(); i++) {
+        if(nodes[i].count == 0)
+            kids[i] = {nodes[i].offset, nodes[i].offset + 1};
+    }
+
+    for(int pass = 0; pass < rotation_passes; pass++)
+        rotate(tree, kids, 0, 0);
+
+    int block = layout == BvhLayout::DepthFirst ? 1 : layout == BvhLayout::Treelet ? treelet_depth : max_depth;
+
+    LinearBvhNodes out;
+    out.reserve(nodes.size());
+    out.push_back(tree[0]);
+
+    //(source node, slot in out); a block is laid out breadth-first, the blocks below it depth-first
+    std::vector<std::pair<int, int>> roots = {{0, 0}};
+    while(!roots.empty()) {
+        auto root = roots.back();
+        roots.pop_back();
+
+        std::vector<std::pair<int, int>> level = {root}, below;
+        for(int d = 0; d < block && !level.empty(); d++) {
+            std::vector<std::pair<int, int>> next;
+            for(const auto& n : level) {
+                if(tree[n.first].count > 0)
+                    continue;
+                int first = static_cast<int>(out.size());
+                out[n.second].offset = first;
+                out.push_back(tree[kids[n.first].first]);
+                out.push_back(tree[kids[n.first].second]);
+                next.emplace_back(kids[n.first].first, first);
+                next.emplace_back(kids[n.first].second, first + 1);
+            }
+            level.swap(next);
+        }
+        for(const auto& n : level) {
+            if(tree[n.first].count == 0)
+                below.push_back(n);
+        }
+        roots.insert(roots.end(), below.rbegin(), below.rend());
+    }
+
+    nodes.swap(out);
+}
+
+//Post-order pass over the subtree at idx, which sits at the given depth. Returns its height.
+template<class T>
+int LinearBvh<T>::rotate(LinearBvhNodes& tree, std::vector<std::pair<int, int>>& kids, int idx, int depth) {
+    if(tree[idx].count > 0)
+        return 1;
+
+    int a = kids[idx].first;
+    int b = kids[idx].second;
+    int height[2] = {rotate(tree, kids, a, depth + 1), rotate(tree, kids, b, depth + 1)};
+
+    //swapping child x with a grandchild under its sibling y changes only the box of y
+    float best_gain = 0;
+    int best_x = -1, best_y = -1, best_slot = 0;
+    for(int side = 0; side < 2; side++) {
+        int x = side ? b : a;
+        int y = side ? a : b;
+        if(tree[y].count > 0 || depth + 2 + height[side] >= max_depth)
+            continue;
+
+        int g[2] = {kids[y].first, kids[y].second};
+        for(int slot = 0; slot < 2; slot++) {
+            float area = AABB<float>::surrounding_box(tree[x].box, tree[g[1 - slot]].box).surface_area();
+            float gain = tree[y].box.surface_area() - area;
+            if(gain > best_gain) {
+                best_gain = gain;
+                best_x = x;
+                best_y = y;
+                best_slot = slot;
+            }
+        }
+    }
+
+    if(best_x >= 0) {
+        auto& y_kids = kids[best_y];
+        int& moved = best_slot ? y_kids.second : y_kids.first;
+        int grandchild = moved;
+        moved = best_x;
+        tree[best_y].box = AABB<float>::surrounding_box(tree[y_kids.first].box, tree[y_kids.second].box);
+        orient(tree, kids, best_y);
+
+        if(kids[idx].first == best_x)
+            kids[idx].first = grandchild;
+        else
+            kids[idx].second = grandchild;
+        orient(tree, kids, idx);
+    }
+
+    //a rotation pushes x one level down, so this stays an upper bound
+    return (best_x >= 0 ? 2 : 1) + std::max(height[0], height[1]);
+}
+
+//Picks the axis that separates the two children best and puts the lower one first
+template<class T>
+void LinearBvh<T>::orient(LinearBvhNodes& tree, std::vector<std::pair<int, int>>& kids, int idx) {
+    auto& k = kids[idx];
+    auto c0 = tree[k.first].box.center();
+    auto c1 = tree[k.second].box.center();
+
+    int axis = 0;
+    float spread = -1;
+    for(int a = 0; a < 3; a++) {
+        float d = std::fabs(c1.e[a] - c0.e[a]);
+        if(d > spread) {
+            spread = d;
+            axis = a;
+        }
+    }
+    tree[idx].axis = static_cast<uint8_t>(axis);
+    if(c0.e[axis] > c1.e[axis])
+        std::swap(k.first, k.second);
+}
+
+template<class T>
+T LinearBvh<T>::cache_lines_per_ray(const std::vector<Ray<T>>& rays, T t_min, T t_max, size_t line_bytes) const {
+    if(rays.empty())
+        return 0;
+
+    std::vector<uintptr_t> lines;
+    size_t total = 0;
+    for(const auto& r : rays) {
+        lines.clear();
+        HitRecord<T> rec;
+        traverse(r, t_min, t_max, rec, [&](int idx) {
+            lines.push_back(reinterpret_cast<uintptr_t>(&nodes[idx])/line_bytes);
+        });
+        std::sort(lines.begin(), lines.end());
+        total += std::unique(lines.begin(), lines.end()) - lines.begin();
+    }
+    return static_cast<T>(total)/rays.size();
+}
+
+template<class T>
+bool LinearBvh<T>::bounding_box(T, T, AABB<T>& out) const {
+    if(nodes.empty())
+        return false;
+
+    const auto& b = nodes[0].box;
+    out = AABB<T>(Vector3<T>(b.minimum.x(), b.minimum.y(), b.minimum.z()),
+                  Vector3<T>(b.maximum.x(), b.maximum.y(), b.maximum.z()));
+    return true;
+}
+
+template<class T>
+bool LinearBvh<T>::hit(const Ray<T>& r, T t_min, T t_max, HitRecord<T>& rec) const noexcept {
+    return traverse(r, t_min, t_max, rec, [](int) {});
+}
+
+//visit is called with the index of every node whose box is read
+template<class T>
+template<class Visit>
+bool LinearBvh<T>::traverse(const Ray<T>& r, T t_min, T t_max, HitRecord<T>& rec, Visit&& visit) const noexcept {
+    if(nodes.empty())
+        return false;
+
+    const Vector3<T> inv_dir(1/r.dir.e[0], 1/r.dir.e[1], 1/r.dir.e[2]);
+    const bool dir_is_neg[3] = {inv_dir.e[0] < 0, inv_dir.e[1] < 0, inv_dir.e[2] < 0};
+
+    int stack[max_depth];
+    int stack_size = 0;
+    int current = 0;
+    bool hit_any = false;
+
+    while(true) {
+        const auto& node = nodes[current];
+        visit(current);
+        if(node.hit(r.orig, inv_dir, t_min, t_max)) {
+            if(node.count > 0) {
+                for(int i = 0; i < node.count; i++) {
+                    if(compiled[node.offset + i].hit(r, t_min, t_max, rec)) {
+                        hit_any = true;
+                        t_max = rec.t;
+                    }
+                }
+                if(stack_size == 0)
+                    break;
+                current = stack[--stack_size];
+            } else if(dir_is_neg[node.axis]) {
+                //visit the child on the near side first
+                stack[stack_size++] = node.offset;
+                current = node.offset + 1;
+            } else {
+                stack[stack_size++] = node.offset + 1;
+                current = node.offset;
+            }
+        } else {
+            if(stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+    }
+
+    return hit_any;
+}
@@ -8,42 +8,67 @@
 
 #include<cmath>
 #include<stdexcept>
+#include<cstdint>
 
 template<typename>
 class HitRecord;
 
+template<typename> class Lambertian;
+template<typename> class Metal;
+template<typename> class Dielectric;
+template<typename> class DiffuseLight;
+template<typename> class Isotropic;
+
+//Built-in materials are told apart by their kind and shaded without virtual calls in
+//material_scatter and material_emitted; user materials are Custom and go through the virtuals.
+//Only the final built-in classes can name another kind, so the kind alone decides the path.
+enum class MaterialKind : uint8_t { Custom, Lambertian, Metal, Dielectric, DiffuseLight, Isotropic };
+
 template<typename T>
 class Material {
 public:
+    const MaterialKind kind;
+
+    Material() noexcept : kind(MaterialKind::Custom) {}
+
     virtual bool scatter(const Ray<T>&, const HitRecord<T>&, Vector3<T>&, Ray<T>&) const = 0;
     virtual Vector3<T> emitted(T, T, const Vector3<T>&) const { return Vector3<T>(0, 0, 0);}
+
+private:
+    friend class Lambertian<T>;
+    friend class Metal<T>;
+    friend class Dielectric<T>;
+    friend class DiffuseLight<T>;
+    friend class Isotropic<T>;
+
+    explicit Material(MaterialKind _kind) noexcept : kind(_kind) {}
 };
 
 template<typename T>
-class Lambertian : public Material<T> {
+class Lambertian final : public Material<T> {
 public:
     std::shared_ptr<Texture<T>> albedo;
 
-    Lambertian(const Vector3<T>& _albedo) : albedo(std::make_shared<SolidColor<T>>(_albedo)) {}
-    Lambertian(std::shared_ptr<Texture<T>> _albedo) : albedo(_albedo) {}
+    Lambertian(const Vector3<T>& _albedo) : Material<T>(MaterialKind::Lambertian), albedo(std::make_shared<SolidColor<T>>(_albedo)) {}
+    Lambertian(std::shared_ptr<Texture<T>> _albedo) : Material<T>(MaterialKind::Lambertian), albedo(_albedo) {}
 
     bool scatter(const Ray<T>& r_in, const HitRecord<T>& rec, Vector3<T>& att, Ray<T>& r_out) const override {
         auto direction = rec.normal + Vector3<T>::random_unit_vector();
         if (direction.near_zero())
             direction = rec.normal;
         r_out = Ray<T>(rec.p, direction, r_in.time);
-        att = albedo->value(rec.u, rec.v, rec.p);
+        att = texture_value(*albedo, rec.u, rec.v, rec.p);
         return true;
     }
 };
 
 template<typename T>
-class Metal : public Material<T> {
+class Metal final : public Material<T> {
 public:
     Vector3<T> albedo;
     T fuzz;
 
-    Metal(const Vector3<T>& _albedo, T _fuzz) noexcept : albedo(_albedo), fuzz(_fuzz < 1 ? _fuzz : 1) {}
+    Metal(const Vector3<T>& _albedo, T _fuzz) noexcept : Material<T>(MaterialKind::Metal), albedo(_albedo), fuzz(_fuzz < 1 ? _fuzz : 1) {}
 
     bool scatter(const Ray<T>& r_in, const HitRecord<T>& rec, Vector3<T>& att, Ray<T>& r_out) const override {
         r_out = Ray<T>(rec.p, r_in.dir.reflect(rec.normal) + fuzz*Vector3<T>::random_unit_vector(), r_in.time);
@@ -53,11 +78,11 @@ public:
 };
 
 template<typename T>
-class Dielectric : public Material<T> {
+class Dielectric final : public Material<T> {
 public:
     T ir;
 
-    Dielectric(T _ir) : ir(_ir) { if (_ir < 0) throw std::invalid_argument("wrong index of refraction");}
+    Dielectric(T _ir) : Material<T>(MaterialKind::Dielectric), ir(_ir) { if (_ir < 0) throw std::invalid_argument("wrong index of refraction");}
 
     bool scatter(const Ray<T>& r_in, const HitRecord<T>& rec, Vector3<T>& att, Ray<T>& r_out) const override {
         att = Vector3<T>(1.0, 1.0, 1.0);
@@ -82,28 +107,49 @@ private:
 };
 
 template<class T>
-class DiffuseLight : public Material<T> {
+class DiffuseLight final : public Material<T> {
 public:
     std::shared_ptr<Texture<T>> emit;
 
-    DiffuseLight(std::shared_ptr<Texture<T>> a) : emit(a) {}
-    DiffuseLight(Vector3<T> c) : emit(std::make_shared<SolidColor<T>>(c)) {}
+    DiffuseLight(std::shared_ptr<Texture<T>> a) : Material<T>(MaterialKind::DiffuseLight), emit(a) {}
+    DiffuseLight(Vector3<T> c) : Material<T>(MaterialKind::DiffuseLight), emit(std::make_shared<SolidColor<T>>(c)) {}
 
     bool scatter(const Ray<T>&, const HitRecord<T>&, Vector3<T>&, Ray<T>&) const override { return false;}
-    Vector3<T> emitted(T u, T v, const Vector3<T>& p) const override { return emit->value(u, v, p);}
+    Vector3<T> emitted(T u, T v, const Vector3<T>& p) const override { return texture_value(*emit, u, v, p);}
 };
 
 template<class T>
-class Isotropic : public Material<T> {
+class Isotropic final : public Material<T> {
 public:
     std::shared_ptr<Texture<T>> albedo;
 
-    Isotropic(Vector3<T> color) : albedo(std::make_shared<SolidColor<T>>(color)) {}
-    Isotropic(std::shared_ptr<Texture<T>> _al) : albedo(_al) {}
+    Isotropic(Vector3<T> color) : Material<T>(MaterialKind::Isotropic), albedo(std::make_shared<SolidColor<T>>(color)) {}
+    Isotropic(std::shared_ptr<Texture<T>> _al) : Material<T>(MaterialKind::Isotropic), albedo(_al) {}
 
     bool scatter(const Ray<T>& r_in, const HitRecord<T>& rec, Vector3<T>& att, Ray<T>& r_out) const override {
         r_out = Ray<T>(rec.p, Vector3<T>::random_unit_vector(), r_in.time);
-        att = albedo->value(rec.u, rec.v, rec.p);
+        att = texture_value(*albedo, rec.u, rec.v, rec.p);
         return true;
     }
 };
+
+template<class T>
+bool material_scatter(const Material<T>& m, const Ray<T>& r_in, const HitRecord<T>& rec, Vector3<T>& att, Ray<T>& r_out) {
+    switch(m.kind) {
+    case MaterialKind::Lambertian: return static_cast<const Lambertian<T>&>(m).scatter(r_in, rec, att, r_out);
+    case MaterialKind::Metal: return static_cast<const Metal<T>&>(m).scatter(r_in, rec, att, r_out);
+    case MaterialKind::Dielectric: return static_cast<const Dielectric<T>&>(m).scatter(r_in, rec, att, r_out);
+    case MaterialKind::DiffuseLight: return false;
+    case MaterialKind::Isotropic: return static_cast<const Isotropic<T>&>(m).scatter(r_in, rec, att, r_out);
+    default: return m.scatter(r_in, rec, att, r_out);
+    }
+}
+
+template<class T>
+Vector3<T> material_emitted(const Material<T>& m, T u, T v, const Vector3<T>& p) {
+    switch(m.kind) {
+    case MaterialKind::Custom: return m.emitted(u, v, p);
+    case MaterialKind::DiffuseLight: return static_cast<const DiffuseLight<T>&>(m).emitted(u, v, p);
+    default: return Vector3<T>(0, 0, 0);
+    }
+}
@@ -53,7 +53,7 @@ public:
 
         rec.normal = Vector3<T>(1, 0, 0);
         rec.front_face = true;
-        rec.mat_ptr = phase_function;
+        rec.mat_ptr = phase_function.get();
 
         return true;
     }
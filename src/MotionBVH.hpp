@@ -0,0 +1,245 @@
+#pragma once
+
+#include "General.hpp"
+#include "HittableObject.hpp"
+#include "HittableList.hpp"
+#include "BVH.hpp"
+#include "LinearBVH.hpp"
+#include "Primitive.hpp"
+#include "AABB.hpp"
+#include "Ray.hpp"
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+
+
+//Topology of a MotionBvh node, same conventions as LinearBvhNode; the bounds live in MotionBvh::bounds
+class MotionBvhNode {
+public:
+    int32_t offset;  // first primitive for leaves, first of the two children for interior nodes
+    uint16_t count;  // number of primitives, 0 for interior nodes
+    uint8_t axis;
+    uint8_t pad;
+};
+
+//BVH for moving geometry: every node stores its bounds at `keys` evenly spaced times over
+//the shutter and a ray is tested against the box interpolated at its time, instead of the
+//union over the whole interval. Exact for objects that move linearly between keys, like
+//MovingSphere; objects following curved paths need more keys.
+template<class T>
+class MotionBvh : public HittableObject<T> {
+public:
+    static constexpr int max_depth = 64;
+
+    std::vector<std::shared_ptr<HittableObject<T>>> primitives; // in leaf order
+    std::vector<Primitive<T>> compiled; // primitives as leaves intersect them
+    std::vector<MotionBvhNode> nodes;
+    std::vector<AABB<float>> bounds; // keys boxes per node, node-major
+    T time0 = 0, time1 = 0;
+    int keys = 2;
+
+    MotionBvh() {}
+    MotionBvh(const std::vector<std::shared_ptr<HittableObject<T>>>&, T, T, int = 2);
+    MotionBvh(const HittableList<T>& list, T _time0, T _time1, int _keys = 2)
+        : MotionBvh(list.objects, _time0, _time1, _keys) {}
+
+    bool hit(const Ray<T>&, T, T, HitRecord<T>&) const noexcept override;
+    bool bounding_box(T, T, AABB<T>&) const override;
+
+    T key_time(int k) const noexcept { return keys > 1 ? time0 + (time1 - time0)*k/(keys - 1) : time0;}
+    //Bounds of node idx at the given time; outside the shutter the union over all keys
+    AABB<T> box_at(int idx, T time) const noexcept;
+
+private:
+    //Key interval [k, k + 1] and position s in it for a time, false outside the shutter
+    bool segment(T time, int& k, T& s) const noexcept;
+    AABB<T> lerp_box(int idx, int k, T s) const noexcept;
+
+    void build(std::vector<BvhPrimitive<T>>&, size_t, size_t, int, int);
+};
+
+template<class T>
+MotionBvh<T>::MotionBvh(const std::vector<std::shared_ptr<HittableObject<T>>>& objects, T _time0, T _time1, int _keys)
+    : time0(_time0), time1(_time1), keys(_keys) {
+    if(keys < 2)
+        throw std::invalid_argument("MotionBvh needs at least two time keys");
+    if(time1 < time0)
+        throw std::invalid_argument("MotionBvh shutter closes before it opens");
+
+    //the topology follows where objects are in the middle of the shutter
+    T mid_time = (time0 + time1)/2;
+    std::vector<BvhPrimitive<T>> prims;
+    prims.reserve(objects.size());
+    for(size_t i = 0; i < objects.size(); i++) {
+        AABB<T> b;
+        if(!objects[i]->bounding_box(mid_time, mid_time, b))
+            throw std::invalid_argument("object without bounding box in MotionBvh");
+        prims.emplace_back(b, i);
+    }
+
+    if(prims.empty())
+        return;
+
+    prepare_primitives(prims, BvhSplit::SAH);
+    nodes.reserve(2*prims.size() - 1);
+    nodes.emplace_back();
+    build(prims, 0, prims.size(), 0, 0);
+    if(bvh_tree_height(nodes) > max_depth)
+        throw std::logic_error("MotionBvh built deeper than its traversal stack");
+
+    primitives.reserve(prims.size());
+    for(const auto& p : prims)
+        primitives.push_back(objects[p.index]);
+    compiled = compile_primitives(primitives);
+
+    //children come after their parent, so one backwards sweep fills every key
+    bounds.resize(nodes.size()*keys);
+    for(int i = static_cast<int>(nodes.size()) - 1; i >= 0; i--) {
+        const auto& node = nodes[i];
+        for(int k = 0; k < keys; k++) {
+            auto& out = bounds[i*keys + k];
+            if(node.count > 0) {
+                T t = key_time(k);
+                AABB<T> box, tmp;
+                primitives[node.offset]->bounding_box(t, t, box);
+                for(int p = 1; p < node.count; p++) {
+                    primitives[node.offset + p]->bounding_box(t, t, tmp);
+                    box = AABB<T>::surrounding_box(box, tmp);
+                }
+                out = conservative_box(box);
+            } else {
+                out = AABB<float>::surrounding_box(bounds[node.offset*keys + k], bounds[(node.offset + 1)*keys + k]);
+            }
+        }
+    }
+}
+
+//Fills nodes[idx], which sits at depth, with the subtree over prims[start, end)
+template<class T>
+void MotionBvh<T>::build(std::vector<BvhPrimitive<T>>& prims, size_t start, size_t end, int idx, int depth) {
+    int axis;
+    size_t mid = bvh_depth_exhausted(depth, end - start, max_depth) ? depth_limited_split(prims, start, end, BvhSplit::SAH, axis)
+                                                                     : partition_primitives(prims, start, end, BvhSplit::SAH, axis);
+    nodes[idx].axis = static_cast<uint8_t>(axis);
+
+    if(mid == start) {
+        nodes[idx].offset = static_cast<int32_t>(start);
+        nodes[idx].count = static_cast<uint16_t>(end - start);
+        return;
+    }
+
+    int first = static_cast<int>(nodes.size());
+    nodes[idx].offset = first;
+    nodes[idx].count = 0;
+    nodes.resize(nodes.size() + 2);
+    build(prims, start, mid, first, depth + 1);
+    build(prims, mid, end, first + 1, depth + 1);
+}
+
+template<class T>
+bool MotionBvh<T>::segment(T time, int& k, T& s) const noexcept {
+    if(!(time >= time0 && time <= time1))
+        return false;
+
+    T u = time1 > time0 ? (time - time0)/(time1 - time0)*(keys - 1) : 0;
+    k = clamp<int>(static_cast<int>(u), 0, keys - 2);
+    s = u - k;
+    return true;
+}
+
+template<class T>
+AABB<T> MotionBvh<T>::lerp_box(int idx, int k, T s) const noexcept {
+    const auto& b0 = bounds[idx*keys + k];
+    const auto& b1 = bounds[idx*keys + k + 1];
+    AABB<T> out;
+    for(int a = 0; a < 3; a++) {
+        out.minimum.e[a] = (1 - s)*b0.minimum.e[a] + s*b1.minimum.e[a];
+        out.maximum.e[a] = (1 - s)*b0.maximum.e[a] + s*b1.maximum.e[a];
+    }
+    return out;
+}
+
+template<class T>
+AABB<T> MotionBvh<T>::box_at(int idx, T time) const noexcept {
+    int k;
+    T s;
+    if(segment(time, k, s))
+        return lerp_box(idx, k, s);
+
+    const AABB<float>* key = &bounds[idx*keys];
+    Vector3<T> lo, hi;
+    for(int a = 0; a < 3; a++) {
+        lo.e[a] = key[0].minimum.e[a];
+        hi.e[a] = key[0].maximum.e[a];
+        for(int k = 1; k < keys; k++) {
+            lo.e[a] = fmin(lo.e[a], static_cast<T>(key[k].minimum.e[a]));
+            hi.e[a] = fmax(hi.e[a], static_cast<T>(key[k].maximum.e[a]));
+        }
+    }
+    return AABB<T>(lo, hi);
+}
+
+template<class T>
+bool MotionBvh<T>::bounding_box(T t0, T t1, AABB<T>& out) const {
+    if(nodes.empty())
+        return false;
+
+    out = AABB<T>::surrounding_box(box_at(0, t0), box_at(0, t1));
+    //anything in between is covered by the keys inside [t0, t1]
+    for(int k = 0; k < keys; k++) {
+        T t = key_time(k);
+        if(t > t0 && t < t1)
+            out = AABB<T>::surrounding_box(out, box_at(0, t));
+    }
+    return true;
+}
+
+template<class T>
+bool MotionBvh<T>::hit(const Ray<T>& r, T t_min, T t_max, HitRecord<T>& rec) const noexcept {
+    if(nodes.empty())
+        return false;
+
+    const Vector3<T> inv_dir(1/r.dir.e[0], 1/r.dir.e[1], 1/r.dir.e[2]);
+    const bool dir_is_neg[3] = {inv_dir.e[0] < 0, inv_dir.e[1] < 0, inv_dir.e[2] < 0};
+
+    //the key interval is the same for every node
+    int k;
+    T s;
+    const bool in_shutter = segment(r.time, k, s);
+
+    int stack[max_depth];
+    int stack_size = 0;
+    int current = 0;
+    bool hit_any = false;
+
+    while(true) {
+        const auto& node = nodes[current];
+        auto box = in_shutter ? lerp_box(current, k, s) : box_at(current, r.time);
+        if(slab_hit(box, r.orig, inv_dir, t_min, t_max)) {
+            if(node.count > 0) {
+                for(int i = 0; i < node.count; i++) {
+                    if(compiled[node.offset + i].hit(r, t_min, t_max, rec)) {
+                        hit_any = true;
+                        t_max = rec.t;
+                    }
+                }
+            } else if(dir_is_neg[node.axis]) {
+                stack[stack_size++] = node.offset;
+                current = node.offset + 1;
+                continue;
+            } else {
+                stack[stack_size++] = node.offset + 1;
+                current = node.offset;
+                continue;
+            }
+        }
+
+        if(stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+
+    return hit_any;
+}
@@ -48,7 +48,7 @@ bool MovingSphere<T>::hit(const Ray<T>& r, T t_min, T t_max, HitRecord<T>& rec)
     rec.t = root;
     rec.p = r.at(root);
     rec.set_face_normal(r, (rec.p - center(r.time))/radius);
-    rec.mat_ptr = mat_ptr;
+    rec.mat_ptr = mat_ptr.get();
 
     return true;
 }
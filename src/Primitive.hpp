@@ -0,0 +1,68 @@
+#pragma once
+
+#include "HittableObject.hpp"
+#include "Sphere.hpp"
+#include "MovingSphere.hpp"
+#include "AARect.hpp"
+#include "Box.hpp"
+#include "Medium.hpp"
+
+#include <memory>
+#include <typeinfo>
+#include <variant>
+#include <vector>
+
+
+//Closed set of the built-in primitives, hit without a virtual call, so acceleration structures
+//get their intersection code inlined into the leaf loop. The exact type is looked up once here;
+//any other object, including subclasses of the built-in ones, is hit virtually. Objects are not
+//copied, the scene keeps the only instance.
+template<class T>
+class Primitive {
+public:
+    std::variant<const Sphere<T>*, const MovingSphere<T>*, const XYRect<T>*, const XZRect<T>*, const YZRect<T>*,
+                 const Box<T>*, const ConstantMedium<T>*, const HittableObject<T>*> shape;
+
+    //obj has to outlive the primitive
+    explicit Primitive(const HittableObject<T>& obj) : shape(&obj) {
+        const auto& type = typeid(obj);
+        if(type == typeid(Sphere<T>))
+            shape = static_cast<const Sphere<T>*>(&obj);
+        else if(type == typeid(MovingSphere<T>))
+            shape = static_cast<const MovingSphere<T>*>(&obj);
+        else if(type == typeid(XYRect<T>))
+            shape = static_cast<const XYRect<T>*>(&obj);
+        else if(type == typeid(XZRect<T>))
+            shape = static_cast<const XZRect<T>*>(&obj);
+        else if(type == typeid(YZRect<T>))
+            shape = static_cast<const YZRect<T>*>(&obj);
+        else if(type == typeid(Box<T>))
+            shape = static_cast<const Box<T>*>(&obj);
+        else if(type == typeid(ConstantMedium<T>))
+            shape = static_cast<const ConstantMedium<T>*>(&obj);
+    }
+
+    bool hit(const Ray<T>& r, T t_min, T t_max, HitRecord<T>& rec) const noexcept {
+        return std::visit([&](const auto& p) { return hit_shape(p, r, t_min, t_max, rec);}, shape);
+    }
+
+private:
+    //p is exactly a P, so the qualified call is its own hit
+    template<class P>
+    static bool hit_shape(const P* p, const Ray<T>& r, T t_min, T t_max, HitRecord<T>& rec) noexcept {
+        return p->P::hit(r, t_min, t_max, rec);
+    }
+    static bool hit_shape(const HittableObject<T>* p, const Ray<T>& r, T t_min, T t_max, HitRecord<T>& rec) noexcept {
+        return p->hit(r, t_min, t_max, rec);
+    }
+};
+
+//Primitive form of every object, in the same order
+template<class T>
+std::vector<Primitive<T>> compile_primitives(const std::vector<std::shared_ptr<HittableObject<T>>>& objects) {
+    std::vector<Primitive<T>> out;
+    out.reserve(objects.size());
+    for(const auto& obj : objects)
+        out.emplace_back(*obj);
+    return out;
+}
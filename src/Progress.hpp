@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+
+
+//Finished work of one frame, counted in pixels. Workers report whole tiles or batches with add(),
+//so the shared counter is touched once per batch instead of once per pixel, and the add that
+//completes the frame wakes the waiting thread at once instead of at its next poll.
+class Progress {
+public:
+    explicit Progress(size_t _total = 0) noexcept : total_units(_total) {}
+
+    //Starts counting a new frame of total units; no worker may be adding meanwhile
+    void reset(size_t _total) noexcept {
+        total_units = _total;
+        done_units.store(0, std::memory_order_relaxed);
+        cancelled.store(false, std::memory_order_relaxed);
+    }
+
+    void add(size_t n) {
+        size_t before = done_units.fetch_add(n, std::memory_order_acq_rel);
+        if(before < total_units && before + n >= total_units) {
+            //taking the lock orders the notification after a waiter's check of finished()
+            { std::lock_guard<std::mutex> lock(mutex);}
+            completed.notify_all();
+        }
+    }
+
+    //Ends the frame early, when it cannot complete because a worker failed; waiters return
+    void cancel() {
+        cancelled.store(true, std::memory_order_release);
+        { std::lock_guard<std::mutex> lock(mutex);}
+        completed.notify_all();
+    }
+
+    size_t done() const noexcept { return done_units.load(std::memory_order_acquire);}
+    size_t total() const noexcept { return total_units;}
+    bool finished() const noexcept { return cancelled.load(std::memory_order_acquire) || done() >= total_units;}
+    int percent() const noexcept { return total_units > 0 ? static_cast<int>(done()*100/total_units) : 100;}
+
+    //Blocks until the frame is finished or cancelled, or timeout has passed; true if finished
+    template<class Rep, class Period>
+    bool wait_for(const std::chrono::duration<Rep, Period>& timeout) {
+        std::unique_lock<std::mutex> lock(mutex);
+        return completed.wait_for(lock, timeout, [this]() { return finished();});
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        completed.wait(lock, [this]() { return finished();});
+    }
+
+private:
+    size_t total_units;
+    std::atomic<size_t> done_units{0};
+    std::atomic<bool> cancelled{false};
+    std::mutex mutex;
+    std::condition_variable completed;
+};
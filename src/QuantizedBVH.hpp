@@ -0,0 +1,176 @@
+#pragma once
+
+#include "General.hpp"
+#include "HittableObject.hpp"
+#include "HittableList.hpp"
+#include "LinearBVH.hpp"
+#include "Ray.hpp"
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+
+//Compact node: its bounds are stored as Q-bit fractions of the parent's decoded box,
+//rounded outwards, so decoding never shrinks the original box
+template<class Q>
+class QuantizedBvhNode {
+public:
+    int32_t offset;  // first primitive for leaves, first of the two children for interior nodes
+    uint16_t count;  // number of primitives, 0 for interior nodes
+    Q qmin[3];
+    Q qmax[3];
+    uint8_t axis;
+
+    static constexpr Q levels = std::numeric_limits<Q>::max();
+
+    static float decode(float lo, float hi, Q q) noexcept {
+        if(q == levels)
+            return hi;
+        return lo + (hi - lo)*(static_cast<float>(q)/levels);
+    }
+
+    AABB<float> decode(const AABB<float>& parent) const noexcept {
+        AABB<float> out;
+        for(int a = 0; a < 3; a++) {
+            out.minimum.e[a] = decode(parent.minimum.e[a], parent.maximum.e[a], qmin[a]);
+            out.maximum.e[a] = decode(parent.minimum.e[a], parent.maximum.e[a], qmax[a]);
+        }
+        return out;
+    }
+
+    void encode(const AABB<float>& parent, const AABB<float>& box) noexcept {
+        for(int a = 0; a < 3; a++) {
+            float lo = parent.minimum.e[a];
+            float hi = parent.maximum.e[a];
+            float extent = hi - lo;
+            float fmin_q = extent > 0 ? (box.minimum.e[a] - lo)/extent*levels : 0;
+            float fmax_q = extent > 0 ? (box.maximum.e[a] - lo)/extent*levels : levels;
+
+            int q0 = clamp<int>(static_cast<int>(std::floor(fmin_q)), 0, levels);
+            int q1 = clamp<int>(static_cast<int>(std::ceil(fmax_q)), q0, levels);
+            //float rounding in decode can land on the wrong side, step until it is conservative
+            while(q0 > 0 && decode(lo, hi, static_cast<Q>(q0)) > box.minimum.e[a])
+                q0--;
+            while(q1 < levels && decode(lo, hi, static_cast<Q>(q1)) < box.maximum.e[a])
+                q1++;
+
+            qmin[a] = static_cast<Q>(q0);
+            qmax[a] = static_cast<Q>(q1);
+        }
+    }
+};
+
+static_assert(sizeof(QuantizedBvhNode<uint8_t>) == 16, "8-bit quantized node should be 16 bytes");
+static_assert(sizeof(QuantizedBvhNode<uint16_t>) == 20, "16-bit quantized node should be 20 bytes");
+
+//LinearBvh topology with quantized bounds: 16 (8-bit) or 20 (16-bit) bytes per node instead of 32
+template<class T, class Q = uint8_t>
+class QuantizedBvh : public HittableObject<T> {
+public:
+    static constexpr int max_depth = 64;
+
+    std::vector<std::shared_ptr<HittableObject<T>>> primitives; // in leaf order
+    std::vector<QuantizedBvhNode<Q>> nodes;
+    AABB<float> root_box;
+
+    QuantizedBvh() {}
+    QuantizedBvh(const LinearBvh<T>&);
+    QuantizedBvh(const HittableList<T>& list, T time0, T time1, BvhSplit split = BvhSplit::SAH)
+        : QuantizedBvh(LinearBvh<T>(list, time0, time1, split)) {}
+
+    bool hit(const Ray<T>&, T, T, HitRecord<T>&) const noexcept override;
+    bool bounding_box(T, T, AABB<T>& out) const override {
+        out = AABB<T>(Vector3<T>(root_box.minimum.x(), root_box.minimum.y(), root_box.minimum.z()),
+                      Vector3<T>(root_box.maximum.x(), root_box.maximum.y(), root_box.maximum.z()));
+        return !nodes.empty();
+    }
+
+private:
+    void encode(const LinearBvh<T>&, int, const AABB<float>&);
+};
+
+template<class T, class Q>
+QuantizedBvh<T, Q>::QuantizedBvh(const LinearBvh<T>& bvh) : primitives(bvh.primitives) {
+    if(bvh.nodes.empty())
+        return;
+    //same topology as the source tree, which has to fit the traversal stack
+    int height = bvh_tree_height(bvh.nodes);
+    if(height < 0 || height > max_depth)
+        throw std::invalid_argument("QuantizedBvh: source tree is malformed or deeper than max_depth");
+
+    nodes.resize(bvh.nodes.size());
+    root_box = bvh.nodes[0].box;
+    encode(bvh, 0, root_box);
+}
+
+//Same indices as the source tree; parent is the decoded box of the node's parent
+template<class T, class Q>
+void QuantizedBvh<T, Q>::encode(const LinearBvh<T>& bvh, int idx, const AABB<float>& parent) {
+    const auto& src = bvh.nodes[idx];
+    auto& node = nodes[idx];
+
+    node.offset = src.offset;
+    node.count = src.count;
+    node.axis = src.axis;
+    node.encode(parent, src.box);
+
+    if(src.count == 0) {
+        auto decoded = node.decode(parent);
+        encode(bvh, src.offset, decoded);
+        encode(bvh, src.offset + 1, decoded);
+    }
+}
+
+template<class T, class Q>
+bool QuantizedBvh<T, Q>::hit(const Ray<T>& r, T t_min, T t_max, HitRecord<T>& rec) const noexcept {
+    if(nodes.empty())
+        return false;
+
+    const Vector3<T> inv_dir(1/r.dir.e[0], 1/r.dir.e[1], 1/r.dir.e[2]);
+    const bool dir_is_neg[3] = {inv_dir.e[0] < 0, inv_dir.e[1] < 0, inv_dir.e[2] < 0};
+
+    //the stack carries the decoded box of each pending node's parent
+    class Entry {
+    public:
+        int node;
+        AABB<float> parent;
+    };
+    Entry stack[max_depth];
+    int stack_size = 0;
+    Entry current{0, root_box};
+    bool hit_any = false;
+
+    while(true) {
+        const auto& node = nodes[current.node];
+        auto box = node.decode(current.parent);
+
+        if(slab_hit(box, r.orig, inv_dir, t_min, t_max)) {
+            if(node.count > 0) {
+                for(int i = 0; i < node.count; i++) {
+                    if(primitives[node.offset + i]->hit(r, t_min, t_max, rec)) {
+                        hit_any = true;
+                        t_max = rec.t;
+                    }
+                }
+            } else if(dir_is_neg[node.axis]) {
+                stack[stack_size++] = Entry{node.offset, box};
+                current = Entry{node.offset + 1, box};
+                continue;
+            } else {
+                stack[stack_size++] = Entry{node.offset + 1, box};
+                current = Entry{node.offset, box};
+                continue;
+            }
+        }
+
+        if(stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+
+    return hit_any;
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include "General.hpp"
+#include "HittableObject.hpp"
+#include "LinearBVH.hpp"
+#include "WideBVH.hpp"
+#include "Ray.hpp"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+
+//Up to N coherent rays in SoA form, one SIMD lane per ray
+template<class T, int N>
+class RayPacket {
+public:
+    static_assert(N == 4 || N == 8 || N == 16, "packets hold 4, 8 or 16 rays");
+
+    T orig[3][N];
+    T inv_dir[3][N];
+    T t_max[N];
+    T far_max; // largest t_max, kept up to date by the tracer
+    int count = 0;
+
+    //Interval bounds over all rays, used to cull whole nodes for large packets.
+    //sign is 0 or 1 when every ray points the same way along the axis, -1 otherwise.
+    T orig_lo[3], orig_hi[3];
+    T inv_lo[3], inv_hi[3];
+    int sign[3];
+    bool frustum = false;
+
+    RayPacket(const Ray<T>* rays, int n, T t_max_all) noexcept;
+
+    //True when the box is certainly missed by every ray of the packet
+    bool frustum_miss(const AABB<float>&, T) const noexcept;
+};
+
+template<class T, int N>
+RayPacket<T, N>::RayPacket(const Ray<T>* rays, int n, T t_max_all) noexcept : count(n) {
+    for(int i = 0; i < N; i++) {
+        //unused lanes repeat the first ray, their results are masked out
+        const auto& r = rays[i < n ? i : 0];
+        for(int a = 0; a < 3; a++) {
+            orig[a][i] = r.orig.e[a];
+            inv_dir[a][i] = 1/r.dir.e[a];
+        }
+        t_max[i] = t_max_all;
+    }
+    far_max = t_max_all;
+
+    //interval culling only pays off for large packets and needs finite directions
+    frustum = N >= 8;
+    for(int a = 0; a < 3; a++) {
+        orig_lo[a] = orig_hi[a] = orig[a][0];
+        inv_lo[a] = inv_hi[a] = inv_dir[a][0];
+        for(int i = 1; i < n; i++) {
+            orig_lo[a] = std::min(orig_lo[a], orig[a][i]);
+            orig_hi[a] = std::max(orig_hi[a], orig[a][i]);
+            inv_lo[a] = std::min(inv_lo[a], inv_dir[a][i]);
+            inv_hi[a] = std::max(inv_hi[a], inv_dir[a][i]);
+        }
+        if(!std::isfinite(inv_lo[a]) || !std::isfinite(inv_hi[a]))
+            frustum = false;
+        sign[a] = inv_lo[a] > 0 ? 0 : inv_hi[a] < 0 ? 1 : -1;
+    }
+}
+
+template<class T, int N>
+bool RayPacket<T, N>::frustum_miss(const AABB<float>& box, T t_min) const noexcept {
+    if(!frustum)
+        return false;
+
+    //interval arithmetic: every ray enters after near and leaves before far
+    T near = t_min;
+    T far = far_max;
+
+    for(int a = 0; a < 3; a++) {
+        //only axes where all rays point the same way have a known entry plane
+        if(sign[a] < 0)
+            continue;
+
+        T entry_plane = sign[a] ? box.maximum.e[a] : box.minimum.e[a];
+        T exit_plane = sign[a] ? box.minimum.e[a] : box.maximum.e[a];
+
+        //(plane - orig)*inv over the intervals of orig and inv, extremes are at the corners
+        T e[4] = {(entry_plane - orig_lo[a])*inv_lo[a], (entry_plane - orig_lo[a])*inv_hi[a],
+                  (entry_plane - orig_hi[a])*inv_lo[a], (entry_plane - orig_hi[a])*inv_hi[a]};
+        T x[4] = {(exit_plane - orig_lo[a])*inv_lo[a], (exit_plane - orig_lo[a])*inv_hi[a],
+                  (exit_plane - orig_hi[a])*inv_lo[a], (exit_plane - orig_hi[a])*inv_hi[a]};
+        near = std::max(near, std::min(std::min(e[0], e[1]), std::min(e[2], e[3])));
+        far = std::min(far, std::max(std::max(x[0], x[1]), std::max(x[2], x[3])));
+    }
+    return near > far;
+}
+
+//Traces up to N primary rays together against a LinearBvh: every node is fetched once for the
+//packet. A node the first active ray hits is entered right away; otherwise large packets try to
+//cull it with the packet's frustum before all rays are tested in one SIMD slab test. Leaves
+//always narrow the packet down to the rays that hit them. Other worlds are traced ray by ray,
+//and so are all bounces, which are no longer coherent.
+template<class T, int N>
+class PacketTracer {
+public:
+    const HittableObject<T>& world;
+    const LinearBvh<T>* bvh;
+
+    PacketTracer(const HittableObject<T>& _world) noexcept
+        : world(_world), bvh(dynamic_cast<const LinearBvh<T>*>(&_world)) {}
+
+    //hits[i] tells whether rays[i] hit anything, recs[i] is only filled when it did
+    void trace(const Ray<T>* rays, int n, T t_min, T t_max, HitRecord<T>* recs, bool* hits) const noexcept;
+
+private:
+    void trace_bvh(const Ray<T>*, int, T, T, HitRecord<T>*, bool*) const noexcept;
+};
+
+template<class T, int N>
+void PacketTracer<T, N>::trace(const Ray<T>* rays, int n, T t_min, T t_max, HitRecord<T>* recs, bool* hits) const noexcept {
+    if(bvh && n > 1) {
+        trace_bvh(rays, n, t_min, t_max, recs, hits);
+        return;
+    }
+    for(int i = 0; i < n; i++)
+        hits[i] = world.hit(rays[i], t_min, t_max, recs[i]);
+}
+
+template<class T, int N>
+void PacketTracer<T, N>::trace_bvh(const Ray<T>* rays, int n, T t_min, T t_max, HitRecord<T>* recs, bool* hits) const noexcept {
+    using Lanes = WideLanes<T, N>;
+
+    for(int i = 0; i < n; i++)
+        hits[i] = false;
+    if(bvh->nodes.empty())
+        return;
+
+    RayPacket<T, N> packet(rays, n, t_max);
+    Lanes orig[3], inv[3];
+    for(int a = 0; a < 3; a++) {
+        orig[a] = Lanes::load(packet.orig[a]);
+        inv[a] = Lanes::load(packet.inv_dir[a]);
+    }
+    const Lanes lanes_t_min = Lanes::set1(t_min);
+
+    //children are ordered by the direction of the first ray
+    const bool dir_is_neg[3] = {packet.inv_dir[0][0] < 0, packet.inv_dir[1][0] < 0, packet.inv_dir[2][0] < 0};
+
+    class Entry {
+    public:
+        int node;
+        int mask; // rays that hit the parent
+    };
+    //LinearBvh builds and load_bvh keep trees within max_depth levels, which bounds the stack
+    Entry stack[LinearBvh<T>::max_depth];
+    int stack_size = 0;
+    Entry current{0, (1 << n) - 1};
+
+    while(true) {
+        const auto& node = bvh->nodes[current.node];
+        int mask = 0;
+
+        int first = 0;
+        while(!(current.mask & (1 << first)))
+            first++;
+        const Vector3<T> first_orig(packet.orig[0][first], packet.orig[1][first], packet.orig[2][first]);
+        const Vector3<T> first_inv(packet.inv_dir[0][first], packet.inv_dir[1][first], packet.inv_dir[2][first]);
+
+        if(node.count == 0 && node.hit(first_orig, first_inv, t_min, packet.t_max[first])) {
+            mask = current.mask;
+        } else if(!packet.frustum_miss(node.box, t_min)) {
+            Lanes t_near = lanes_t_min;
+            Lanes t_far = Lanes::load(packet.t_max);
+            for(int a = 0; a < 3; a++) {
+                Lanes t0 = (Lanes::set1(node.box.minimum.e[a]) - orig[a])*inv[a];
+                Lanes t1 = (Lanes::set1(node.box.maximum.e[a]) - orig[a])*inv[a];
+                //a ray in a face plane with a zero direction component gets 0*inf = NaN; min and max
+                //return their second operand then, so NaN falls back to t_near/t_far as in slab_hit
+                t_near = Lanes::min(Lanes::max(t0, t_near), Lanes::max(t1, t_near));
+                t_far = Lanes::max(Lanes::min(t0, t_far), Lanes::min(t1, t_far));
+            }
+            mask = Lanes::le_mask(t_near, t_far) & current.mask;
+        }
+
+        if(mask) {
+            if(node.count > 0) {
+                for(int i = 0; i < n; i++) {
+                    if(!(mask & (1 << i)))
+                        continue;
+                    for(int p = 0; p < node.count; p++) {
+                        if(bvh->compiled[node.offset + p].hit(rays[i], t_min, packet.t_max[i], recs[i])) {
+                            hits[i] = true;
+                            packet.t_max[i] = recs[i].t;
+                        }
+                    }
+                }
+                packet.far_max = packet.t_max[0];
+                for(int i = 1; i < n; i++)
+                    packet.far_max = std::max(packet.far_max, packet.t_max[i]);
+            } else if(dir_is_neg[node.axis]) {
+                stack[stack_size++] = Entry{node.offset, mask};
+                current = Entry{node.offset + 1, mask};
+                continue;
+            } else {
+                stack[stack_size++] = Entry{node.offset + 1, mask};
+                current = Entry{node.offset, mask};
+                continue;
+            }
+        }
+
+        if(stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+}
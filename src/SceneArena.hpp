@@ -0,0 +1,93 @@
+#pragma once
+
+#include <memory>
+#include <new>
+#include <vector>
+#include <utility>
+#include <typeinfo>
+#include <typeindex>
+#include <unordered_map>
+
+
+//Owns the objects of a scene: primitives, materials, textures and acceleration structures are
+//placed in large blocks, one run of blocks per type, so objects of a type sit next to each other
+//and a scene is torn down block by block instead of object by object.
+//make() hands out non-owning shared_ptrs: they go anywhere the shared_ptr API is used, copying
+//them touches no reference count, and none of them may be used after the arena is gone.
+class SceneArena {
+public:
+    static constexpr size_t block_bytes = 64*1024;
+
+    SceneArena() {}
+    SceneArena(const SceneArena&) = delete;
+    SceneArena& operator=(const SceneArena&) = delete;
+    ~SceneArena() { clear();}
+
+    template<class X, class... Args>
+    std::shared_ptr<X> make(Args&&... args) {
+        X* p = pool<X>().create(std::forward<Args>(args)...);
+        count++;
+        return std::shared_ptr<X>(std::shared_ptr<X>(), p);
+    }
+
+    //Number of objects alive in the arena
+    size_t size() const noexcept { return count;}
+
+    //Destroys every object; handles from make() dangle afterwards
+    void clear() noexcept {
+        by_type.clear();
+        pools.clear();
+        count = 0;
+    }
+
+private:
+    class Pool {
+    public:
+        virtual ~Pool() {}
+    };
+
+    //Objects of type X, per_block of them to a block. Blocks never move, so neither do objects.
+    template<class X>
+    class TypedPool : public Pool {
+    public:
+        static constexpr size_t per_block = sizeof(X) < block_bytes ? block_bytes/sizeof(X) : 1;
+
+        template<class... Args>
+        X* create(Args&&... args) {
+            if(used == per_block) {
+                blocks.push_back(static_cast<X*>(::operator new(per_block*sizeof(X), std::align_val_t(alignof(X)))));
+                used = 0;
+            }
+            X* p = new(blocks.back() + used) X(std::forward<Args>(args)...);
+            used++;
+            return p;
+        }
+
+        ~TypedPool() override {
+            for(size_t b = 0; b < blocks.size(); b++) {
+                size_t n = b + 1 == blocks.size() ? used : per_block;
+                for(size_t i = 0; i < n; i++)
+                    blocks[b][i].~X();
+                ::operator delete(blocks[b], std::align_val_t(alignof(X)));
+            }
+        }
+
+    private:
+        std::vector<X*> blocks;
+        size_t used = per_block; // objects in the last block
+    };
+
+    std::vector<std::unique_ptr<Pool>> pools; // in order of first use
+    std::unordered_map<std::type_index, Pool*> by_type;
+    size_t count = 0;
+
+    template<class X>
+    TypedPool<X>& pool() {
+        auto& p = by_type[std::type_index(typeid(X))];
+        if(!p) {
+            pools.push_back(std::make_unique<TypedPool<X>>());
+            p = pools.back().get();
+        }
+        return *static_cast<TypedPool<X>*>(p);
+    }
+};
@@ -51,7 +51,7 @@ bool Sphere<T>::hit(const Ray<T>& r, T t_min, T t_max, HitRecord<T>& rec) const
     Vector3<T> out_norm = (rec.p - center)/radius;
     rec.set_face_normal(r, out_norm);
     get_sphere_uv(out_norm, rec.u, rec.v);
-    rec.mat_ptr = mat_ptr;
+    rec.mat_ptr = mat_ptr.get();
 
     return true;
 }
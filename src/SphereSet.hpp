@@ -0,0 +1,278 @@
+#pragma once
+
+#include "General.hpp"
+#include "HittableObject.hpp"
+#include "HittableList.hpp"
+#include "Sphere.hpp"
+#include "BVH.hpp"
+#include "LinearBVH.hpp"
+#include "WideBVH.hpp"
+#include "Ray.hpp"
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <typeinfo>
+#include <unordered_map>
+#include <stdexcept>
+
+
+//Below this many spheres packing them gains nothing over separate objects
+constexpr size_t default_sphere_set_min = 32;
+
+//Many static spheres as one primitive: centers, radii and material ids live in SoA arrays in
+//leaf order, under a tree whose leaves hold up to leaf_size spheres. Leaves are intersected
+//lanes spheres per instruction, and the hit record is filled once for the nearest sphere.
+template<class T>
+class SphereSet : public HittableObject<T> {
+public:
+    static constexpr int lanes = 4;
+    static constexpr int leaf_size = 8;
+    static constexpr int max_depth = 64;
+
+    std::vector<T> center[3]; // padded with lanes zero entries, so groups past the last leaf can be loaded
+    std::vector<T> radius;
+    std::vector<uint32_t> material; // index into materials
+    std::vector<std::shared_ptr<Material<T>>> materials;
+    LinearBvhNodes nodes;
+
+    SphereSet() {}
+    SphereSet(const std::vector<std::shared_ptr<Sphere<T>>>&);
+
+    size_t size() const noexcept { return count;}
+
+    bool hit(const Ray<T>&, T, T, HitRecord<T>&) const noexcept override;
+    bool bounding_box(T, T, AABB<T>& out) const override {
+        out = box;
+        return count > 0;
+    }
+
+private:
+    using Lanes = WideLanes<T, lanes>;
+
+    //the ray broadcast to all lanes
+    class RayLanes {
+    public:
+        Lanes orig[3], dir[3];
+        Lanes a; // dot(dir, dir)
+        Lanes inv_a;
+    };
+
+    size_t count = 0;
+    AABB<T> box;
+
+    void build(std::vector<BvhPrimitive<T>>&, size_t, size_t, int, int);
+    int intersect(const RayLanes&, int, int, T, T&) const noexcept;
+};
+
+template<class T>
+SphereSet<T>::SphereSet(const std::vector<std::shared_ptr<Sphere<T>>>& spheres) : count(spheres.size()) {
+    if(spheres.empty())
+        return;
+
+    std::vector<BvhPrimitive<T>> prims;
+    prims.reserve(count);
+    for(size_t i = 0; i < count; i++) {
+        AABB<T> b;
+        spheres[i]->bounding_box(0, 0, b);
+        prims.emplace_back(b, i);
+        box = i == 0 ? b : AABB<T>::surrounding_box(box, b);
+    }
+
+    nodes.reserve(2*(count/leaf_size + 1));
+    nodes.emplace_back();
+    build(prims, 0, count, 0, 0);
+    if(bvh_tree_height(nodes) > max_depth)
+        throw std::logic_error("SphereSet built deeper than its traversal stack");
+
+    std::unordered_map<const Material<T>*, uint32_t> ids;
+    for(int a = 0; a < 3; a++)
+        center[a].reserve(count + lanes);
+    radius.reserve(count + lanes);
+    material.reserve(count);
+
+    for(const auto& p : prims) {
+        const auto& s = *spheres[p.index];
+        for(int a = 0; a < 3; a++)
+            center[a].push_back(s.center.e[a]);
+        radius.push_back(s.radius);
+
+        auto id = ids.emplace(s.mat_ptr.get(), static_cast<uint32_t>(materials.size()));
+        if(id.second)
+            materials.push_back(s.mat_ptr);
+        material.push_back(id.first->second);
+    }
+    for(int k = 0; k < lanes; k++) {
+        for(int a = 0; a < 3; a++)
+            center[a].push_back(0);
+        radius.push_back(0);
+    }
+}
+
+//Fills nodes[idx], which sits at depth, with the subtree over prims[start, end); binned SAH down
+//to leaf_size spheres, median splits once the depth limit leaves no room for anything else
+template<class T>
+void SphereSet<T>::build(std::vector<BvhPrimitive<T>>& prims, size_t start, size_t end, int idx, int depth) {
+    AABB<T> bounds = prims[start].box;
+    for(size_t i = start + 1; i < end; i++)
+        bounds = AABB<T>::surrounding_box(bounds, prims[i].box);
+    nodes[idx].box = conservative_box(bounds);
+    nodes[idx].axis = 0;
+
+    size_t n = end - start;
+    if(n <= static_cast<size_t>(leaf_size)) {
+        nodes[idx].offset = static_cast<int32_t>(start);
+        nodes[idx].count = static_cast<uint16_t>(n);
+        return;
+    }
+
+    auto first = prims.begin() + start;
+    auto last = prims.begin() + end;
+    int axis = -1;
+    size_t mid = start;
+    if(!bvh_depth_exhausted(depth, n, max_depth)) {
+        auto split = find_sah_split<T>(first, last, [](const BvhPrimitive<T>& p) { return p.box;});
+        axis = split.axis;
+        if(axis >= 0)
+            mid = std::partition(first, last, [&](const BvhPrimitive<T>& p) { return split.goes_left(p.centroid);}) - prims.begin();
+    }
+    //coincident centroids, an empty side or no levels left: halve the range
+    if(mid == start || mid == end)
+        mid = median_split(prims, start, end, axis);
+
+    int child = static_cast<int>(nodes.size());
+    nodes[idx].axis = static_cast<uint8_t>(axis);
+    nodes[idx].offset = child;
+    nodes[idx].count = 0;
+    nodes.resize(nodes.size() + 2);
+
+    build(prims, start, mid, child, depth + 1);
+    build(prims, mid, end, child + 1, depth + 1);
+}
+
+//Nearest of the n <= lanes spheres from first on that the ray hits in [t_min, t_max], -1 if none.
+//t_max is lowered to its distance.
+template<class T>
+int SphereSet<T>::intersect(const RayLanes& r, int first, int n, T t_min, T& t_max) const noexcept {
+    //with oc = center - orig, the roots are (b -+ sqrt(b*b - a*c))/a
+    Lanes oc[3];
+    for(int a = 0; a < 3; a++)
+        oc[a] = Lanes::load(&center[a][first]) - r.orig[a];
+    Lanes rad = Lanes::load(&radius[first]);
+    Lanes b = oc[0]*r.dir[0] + oc[1]*r.dir[1] + oc[2]*r.dir[2];
+    Lanes c = oc[0]*oc[0] + oc[1]*oc[1] + oc[2]*oc[2] - rad*rad;
+    Lanes disc = b*b - r.a*c;
+
+    const Lanes zero = Lanes::set1(0);
+    int mask = Lanes::le_mask(zero, disc) & ((1 << n) - 1);
+    if(!mask)
+        return -1;
+
+    Lanes root = Lanes::sqrt(Lanes::max(disc, zero));
+    T near[lanes], far[lanes];
+    ((b - root)*r.inv_a).store(near);
+    ((b + root)*r.inv_a).store(far);
+
+    int best = -1;
+    for(int i = 0; i < n; i++) {
+        if(!(mask & (1 << i)))
+            continue;
+        T t = near[i] < t_min ? far[i] : near[i];
+        if(t < t_min || t > t_max)
+            continue;
+        t_max = t;
+        best = first + i;
+    }
+    return best;
+}
+
+template<class T>
+bool SphereSet<T>::hit(const Ray<T>& r, T t_min, T t_max, HitRecord<T>& rec) const noexcept {
+    T a = r.dir.length_squared();
+    if(nodes.empty() || a == 0)
+        return false;
+
+    RayLanes lanes_ray;
+    for(int k = 0; k < 3; k++) {
+        lanes_ray.orig[k] = Lanes::set1(r.orig.e[k]);
+        lanes_ray.dir[k] = Lanes::set1(r.dir.e[k]);
+    }
+    lanes_ray.a = Lanes::set1(a);
+    lanes_ray.inv_a = Lanes::set1(1/a);
+
+    const Vector3<T> inv_dir(1/r.dir.e[0], 1/r.dir.e[1], 1/r.dir.e[2]);
+    const bool dir_is_neg[3] = {inv_dir.e[0] < 0, inv_dir.e[1] < 0, inv_dir.e[2] < 0};
+
+    int stack[max_depth];
+    int stack_size = 0;
+    int current = 0;
+    int best = -1;
+
+    while(true) {
+        const auto& node = nodes[current];
+        if(node.hit(r.orig, inv_dir, t_min, t_max)) {
+            if(node.count > 0) {
+                for(int g = 0; g < node.count; g += lanes) {
+                    int i = intersect(lanes_ray, node.offset + g, std::min<int>(lanes, node.count - g), t_min, t_max);
+                    if(i >= 0)
+                        best = i;
+                }
+                if(stack_size == 0)
+                    break;
+                current = stack[--stack_size];
+            } else if(dir_is_neg[node.axis]) {
+                stack[stack_size++] = node.offset;
+                current = node.offset + 1;
+            } else {
+                stack[stack_size++] = node.offset + 1;
+                current = node.offset;
+            }
+        } else {
+            if(stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+    }
+
+    if(best < 0)
+        return false;
+
+    const Vector3<T> c(center[0][best], center[1][best], center[2][best]);
+    rec.t = t_max;
+    rec.p = r.at(t_max);
+    Vector3<T> out_norm = (rec.p - c)/radius[best];
+    rec.set_face_normal(r, out_norm);
+    Sphere<T>::get_sphere_uv(out_norm, rec.u, rec.v);
+    rec.mat_ptr = materials[material[best]].get();
+
+    return true;
+}
+
+//Objects of world that gather_spheres packs: exactly Sphere, not subclasses
+template<class T>
+size_t count_plain_spheres(const HittableList<T>& world) {
+    size_t n = 0;
+    for(const auto& obj : world.objects)
+        n += typeid(*obj) == typeid(Sphere<T>);
+    return n;
+}
+
+//Copy of world with its plain spheres packed into one SphereSet, if it has at least min_spheres of them
+template<class T>
+HittableList<T> gather_spheres(const HittableList<T>& world, size_t min_spheres = default_sphere_set_min) {
+    std::vector<std::shared_ptr<Sphere<T>>> spheres;
+    HittableList<T> out;
+
+    for(const auto& obj : world.objects) {
+        if(typeid(*obj) == typeid(Sphere<T>))
+            spheres.push_back(std::static_pointer_cast<Sphere<T>>(obj));
+        else
+            out.add(obj);
+    }
+
+    if(spheres.size() < min_spheres)
+        return world;
+    out.add(std::make_shared<SphereSet<T>>(spheres));
+    return out;
+}
@@ -9,68 +9,98 @@
 
 #include <memory>
 #include <cmath>
+#include <cstdint>
 
 
+template<class> class SolidColor;
+template<class> class CheckerTexture;
+template<class> class NoiseTexture;
+template<class> class TurbulenceTexture;
+template<class> class ImageTexture;
+
+//Built-in textures are told apart by their kind and looked up without a virtual call in
+//texture_value; user textures are Custom and go through value. Only the final built-in
+//classes can name another kind.
+enum class TextureKind : uint8_t { Custom, Solid, Checker, Noise, Turbulence, Image };
+
 template<class T>
 class Texture {
 public:
+    const TextureKind kind;
+
+    Texture() noexcept : kind(TextureKind::Custom) {}
+
     virtual Vector3<T> value(T, T, const Vector3<T>&) const = 0;
+
+private:
+    friend class SolidColor<T>;
+    friend class CheckerTexture<T>;
+    friend class NoiseTexture<T>;
+    friend class TurbulenceTexture<T>;
+    friend class ImageTexture<T>;
+
+    explicit Texture(TextureKind _kind) noexcept : kind(_kind) {}
 };
 
 template<class T>
-class SolidColor : public Texture<T> {
+Vector3<T> texture_value(const Texture<T>&, T, T, const Vector3<T>&);
+
+template<class T>
+class SolidColor final : public Texture<T> {
 public:
     Vector3<T> color_value;
 
-    SolidColor() {}
-    SolidColor(Vector3<T> _color) : color_value(_color) {}
+    SolidColor() : Texture<T>(TextureKind::Solid) {}
+    SolidColor(Vector3<T> _color) : Texture<T>(TextureKind::Solid), color_value(_color) {}
     SolidColor(T r, T g, T b) : SolidColor<T>(Vector3<T>(r, g, b)) {}
 
     Vector3<T> value(T, T, const Vector3<T>&) const override { return color_value;}
 };
 
 template<class T>
-class CheckerTexture : public Texture<T> {
+class CheckerTexture final : public Texture<T> {
 public:
     std::shared_ptr<Texture<T>> odd;
     std::shared_ptr<Texture<T>> even;
 
-    CheckerTexture() {}
-    CheckerTexture(std::shared_ptr<Texture<T>> _even, std::shared_ptr<Texture<T>> _odd) : even(_even), odd(_odd) {}
-    CheckerTexture(Vector3<T> c1, Vector3<T> c2) : even(std::make_shared<SolidColor<T>>(c1)), odd(std::make_shared<SolidColor<T>>(c2)) {}
+    CheckerTexture() : Texture<T>(TextureKind::Checker) {}
+    CheckerTexture(std::shared_ptr<Texture<T>> _even, std::shared_ptr<Texture<T>> _odd)
+        : Texture<T>(TextureKind::Checker), odd(_odd), even(_even) {}
+    CheckerTexture(Vector3<T> c1, Vector3<T> c2)
+        : Texture<T>(TextureKind::Checker), odd(std::make_shared<SolidColor<T>>(c2)), even(std::make_shared<SolidColor<T>>(c1)) {}
 
     Vector3<T> value(T u, T v, const Vector3<T>& p) const override {
         if(sin(10*p.x())*sin(10*p.y())*sin(10*p.z()) < 0)
-            return odd->value(u, v, p);
-        return even->value(u, v, p);
+            return texture_value(*odd, u, v, p);
+        return texture_value(*even, u, v, p);
     }
 };
 
 template<class T>
-class NoiseTexture : public Texture<T> {
+class NoiseTexture final : public Texture<T> {
 public:
     Perlin<T> noise;
     T scale;
 
-    NoiseTexture(T _scale) : scale(_scale) {}
+    NoiseTexture(T _scale) : Texture<T>(TextureKind::Noise), scale(_scale) {}
 
     Vector3<T> value(T, T, const Vector3<T>& p) const override {return Vector3<T>(1, 1, 1)*0.5*(1+noise.noise(scale*p));}
 };
 
 
 template<class T>
-class TurbulenceTexture : public Texture<T> {
+class TurbulenceTexture final : public Texture<T> {
 public:
     Perlin<T> noise;
     T scale;
 
-    TurbulenceTexture(T _scale) : scale(_scale) {}
+    TurbulenceTexture(T _scale) : Texture<T>(TextureKind::Turbulence), scale(_scale) {}
 
     Vector3<T> value(T, T, const Vector3<T>& p) const override {return Vector3<T>(1, 1, 1)* 0.5 * (1 + sin(scale*p.z() + 10*noise.turb(p)));}
 };
 
 template<class T>
-class ImageTexture : public Texture<T> {
+class ImageTexture final : public Texture<T> {
 private:
     unsigned char* data;
     int width, height;
@@ -79,8 +109,8 @@ private:
 public:
     const static int bytes_per_pixel = 3;
 
-    ImageTexture() : data(nullptr), width(0), height(0), bytes_per_scanline(0) {}
-    ImageTexture(const char* filename) {
+    ImageTexture() : Texture<T>(TextureKind::Image), data(nullptr), width(0), height(0), bytes_per_scanline(0) {}
+    ImageTexture(const char* filename) : Texture<T>(TextureKind::Image) {
         auto components_per_pixel = bytes_per_pixel;
 
         data = stbi_load(filename, &width, &height, &components_per_pixel, components_per_pixel);
@@ -119,4 +149,14 @@ public:
     }
 };
 
-
+template<class T>
+Vector3<T> texture_value(const Texture<T>& tex, T u, T v, const Vector3<T>& p) {
+    switch(tex.kind) {
+    case TextureKind::Solid: return static_cast<const SolidColor<T>&>(tex).value(u, v, p);
+    case TextureKind::Checker: return static_cast<const CheckerTexture<T>&>(tex).value(u, v, p);
+    case TextureKind::Noise: return static_cast<const NoiseTexture<T>&>(tex).value(u, v, p);
+    case TextureKind::Turbulence: return static_cast<const TurbulenceTexture<T>&>(tex).value(u, v, p);
+    case TextureKind::Image: return static_cast<const ImageTexture<T>&>(tex).value(u, v, p);
+    default: return tex.value(u, v, p);
+    }
+}
@@ -3,14 +3,124 @@
 #include <thread>
 #include <chrono>
 #include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <stdexcept>
+#include <type_traits>
 
+
+//Worker threads to use when none are asked for: one per hardware thread
+inline unsigned default_thread_count() noexcept {
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+//Persistent pool of render threads, shared by the whole program. Workers are started once and
+//sleep on the task queue between frames, so rendering a frame costs no thread creation.
 class ThreadManager {
 private:
-    ThreadManager() {}
-    static std::shared_ptr<ThreadManager> instance;
+    explicit ThreadManager(unsigned n_threads);
+
 public:
-    std::shared_ptr<ThreadManager> get_instance() {
+    ThreadManager(const ThreadManager&) = delete;
+    ThreadManager& operator=(const ThreadManager&) = delete;
+    ~ThreadManager() { shutdown();}
 
+    //The pool, started with default_thread_count() workers on first use
+    static std::shared_ptr<ThreadManager> get_instance() {
+        static std::shared_ptr<ThreadManager> instance(new ThreadManager(default_thread_count()));
+        return instance;
     }
 
+    size_t size() const noexcept { return workers.size();}
+
+    //Queues task; the future gives its result, or rethrows what it threw
+    template<class F>
+    std::future<std::invoke_result_t<F>> submit(F&& task);
+
+    //Blocks until the queue is empty and no task is running
+    void wait();
+
+    //Runs the tasks already queued, then stops the workers; submit throws afterwards
+    void shutdown();
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable task_ready;
+    std::condition_variable idle;
+    size_t running = 0;
+    bool stopping = false;
+
+    void work();
 };
+
+inline ThreadManager::ThreadManager(unsigned n_threads) {
+    if(n_threads == 0)
+        throw std::invalid_argument("ThreadManager: needs at least one thread");
+    workers.reserve(n_threads);
+    for(unsigned i = 0; i < n_threads; i++)
+        workers.emplace_back(&ThreadManager::work, this);
+}
+
+template<class F>
+std::future<std::invoke_result_t<F>> ThreadManager::submit(F&& task) {
+    //std::function has to be copyable, the packaged task is not
+    auto job = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(task));
+    auto result = job->get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(stopping)
+            throw std::runtime_error("ThreadManager: submit after shutdown");
+        tasks.emplace_back([job]() { (*job)();});
+    }
+    task_ready.notify_one();
+    return result;
+}
+
+inline void ThreadManager::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]() { return tasks.empty() && running == 0;});
+}
+
+inline void ThreadManager::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(stopping)
+            return;
+        stopping = true;
+    }
+    task_ready.notify_all();
+    for(auto& t : workers)
+        t.join();
+}
+
+inline void ThreadManager::work() {
+    while(true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            task_ready.wait(lock, [this]() { return stopping || !tasks.empty();});
+            if(tasks.empty())
+                return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+            running++;
+        }
+
+        task();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running--;
+            if(tasks.empty() && running == 0)
+                idle.notify_all();
+        }
+    }
+}
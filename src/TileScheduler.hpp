@@ -0,0 +1,109 @@
+#pragma once
+
+#include "ThreadManager.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+
+//Pixels [x0, x1) x [y0, y1) of the image, rows counted from the bottom as in write_color
+class Tile {
+public:
+    int x0, y0, x1, y1;
+
+    int width() const noexcept { return x1 - x0;}
+    int height() const noexcept { return y1 - y0;}
+    int pixels() const noexcept { return width()*height();}
+};
+
+//Splits a frame into tiles that workers take one at a time from a shared atomic index, so a
+//thread that drew cheap tiles keeps pulling work while another is stuck in an expensive region.
+//Tiles are handed out from the top row of tiles down, left to right.
+class TileScheduler {
+public:
+    static constexpr int default_tile_size = 16;
+
+    TileScheduler(int width, int height, int tile_w = default_tile_size, int tile_h = default_tile_size);
+
+    size_t size() const noexcept { return tiles.size();}
+    const Tile& operator[](size_t i) const noexcept { return tiles[i];}
+
+    //Takes the next tile, false once all of them are taken
+    bool next(Tile& tile) noexcept {
+        size_t i = next_tile.fetch_add(1, std::memory_order_relaxed);
+        if(i >= tiles.size())
+            return false;
+        tile = tiles[i];
+        return true;
+    }
+
+    //Hands out no more tiles of this frame
+    void cancel() noexcept { next_tile.store(tiles.size(), std::memory_order_relaxed);}
+
+    //Makes every tile available again, for the next frame
+    void reset() noexcept { next_tile.store(0, std::memory_order_relaxed);}
+
+    //Starts one loop running work(tile, worker_index) over the remaining tiles on every worker
+    //of pool and returns at once; the futures give how long each worker spent inside work, in
+    //seconds. work is copied into the loops, the scheduler has to outlive them. If work throws,
+    //the remaining tiles are cancelled and that worker's future rethrows.
+    template<class F>
+    std::vector<std::future<double>> start(F work, ThreadManager& pool = *ThreadManager::get_instance());
+
+    //start, then waits for every loop to end; rethrows what work threw
+    template<class F>
+    std::vector<double> run(F work, ThreadManager& pool = *ThreadManager::get_instance());
+
+private:
+    std::vector<Tile> tiles;
+    std::atomic<size_t> next_tile{0};
+};
+
+inline TileScheduler::TileScheduler(int width, int height, int tile_w, int tile_h) {
+    if(width <= 0 || height <= 0 || tile_w <= 0 || tile_h <= 0)
+        throw std::invalid_argument("TileScheduler: image and tile sizes must be positive");
+
+    for(int top = height; top > 0; top -= tile_h) {
+        for(int left = 0; left < width; left += tile_w)
+            tiles.push_back(Tile{left, std::max(0, top - tile_h), std::min(width, left + tile_w), top});
+    }
+}
+
+template<class F>
+std::vector<std::future<double>> TileScheduler::start(F work, ThreadManager& pool) {
+    std::vector<std::future<double>> busy;
+    for(size_t i = 0; i < pool.size(); i++) {
+        busy.push_back(pool.submit([this, work, i]() mutable {
+            double seconds = 0;
+            Tile tile;
+            while(next(tile)) {
+                auto start = std::chrono::steady_clock::now();
+                try {
+                    work(tile, static_cast<unsigned>(i));
+                } catch(...) {
+                    cancel();
+                    throw;
+                }
+                seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+            return seconds;
+        }));
+    }
+    return busy;
+}
+
+template<class F>
+std::vector<double> TileScheduler::run(F work, ThreadManager& pool) {
+    auto pending = start(work, pool);
+    //every loop has to end before an exception leaves, they may still use what work refers to
+    for(auto& f : pending)
+        f.wait();
+    std::vector<double> busy;
+    for(auto& f : pending)
+        busy.push_back(f.get());
+    return busy;
+}
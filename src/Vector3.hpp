@@ -1,6 +1,7 @@
 #pragma once
 
 #include "General.hpp"
+#include "Vector3Simd.hpp"
 
 #include <iostream>
 #include <cmath>
@@ -8,8 +9,10 @@
 
 template<typename T>
 class Vector3 {
+    using Lanes = Vector3Lanes<T>;
+
 public:
-    T e[3];
+    alignas(Lanes::align) T e[Lanes::size]; // x, y, z and, with SIMD_VECTOR3, a zero pad lane
 
     Vector3<T> () noexcept : e{0, 0, 0} {}
     Vector3<T> (T e0, T e1, T e2) noexcept : e{e0, e1, e2} {}
@@ -27,7 +30,7 @@ public:
     Vector3<T> refract(const Vector3<T>&, T) const noexcept;
 
     Vector3<T> operator+() const noexcept { return Vector3(e[0], e[1], e[2]);}
-    Vector3<T> operator-() const noexcept { return Vector3(-e[0], -e[1], -e[2]);}
+    Vector3<T> operator-() const noexcept { return of(Lanes::sub(Lanes::set1(0), reg()));}
     const T& operator[](int i) const;
     T& operator[](int i );
 
@@ -36,22 +39,18 @@ public:
     Vector3<T>& operator*=(const T a) noexcept;
     Vector3<T>& operator/=(const T a) { return *this*=1/a;}
 
-    T length_squared() const noexcept { return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];}
+    T length_squared() const noexcept { return Lanes::dot(reg(), reg());}
     T length() const noexcept { return sqrt(this->length_squared());}
     Vector3<T> unit() const { return *this/this->length();}
 
-    friend Vector3<T> operator+(const Vector3<T> &l, const Vector3<T> &r) noexcept { return Vector3<T>(l.e[0] + r.e[0], l.e[1] + r.e[1], l.e[2] + r.e[2]);}
-    friend Vector3<T> operator-(const Vector3<T> &l, const Vector3<T> &r) noexcept { return l + -r;}
-    friend Vector3<T> operator*(const Vector3<T> &l, const Vector3<T> &r) noexcept { return Vector3(l.e[0]*r.e[0], l.e[1]*r.e[1], l.e[2]*r.e[2]);}
-    friend Vector3<T> operator*(const Vector3<T> &l, const T a) noexcept { return Vector3(l.e[0]*a, l.e[1]*a, l.e[2]*a);}
+    friend Vector3<T> operator+(const Vector3<T> &l, const Vector3<T> &r) noexcept { return of(Lanes::add(l.reg(), r.reg()));}
+    friend Vector3<T> operator-(const Vector3<T> &l, const Vector3<T> &r) noexcept { return of(Lanes::sub(l.reg(), r.reg()));}
+    friend Vector3<T> operator*(const Vector3<T> &l, const Vector3<T> &r) noexcept { return of(Lanes::mul(l.reg(), r.reg()));}
+    friend Vector3<T> operator*(const Vector3<T> &l, const T a) noexcept { return of(Lanes::mul(l.reg(), Lanes::set1(a)));}
     friend Vector3<T> operator*(const T a, const Vector3<T> &r) noexcept { return r*a;}
     friend Vector3<T> operator/(const Vector3<T> &l, const T a) { return l*(1/a);}
-    friend T dot(const Vector3<T> &l, const Vector3<T> &r) noexcept { return l.e[0]*r.e[0] + l.e[1]*r.e[1] + l.e[2]*r.e[2];}
-    friend Vector3<T> cross(const Vector3<T> &l, const Vector3<T> &r) noexcept {
-        return Vector3<T>(l.e[1] * r.e[2] - l.e[2] * r.e[1],
-                    l.e[2] * r.e[0] - l.e[0] * r.e[2],
-                    l.e[0] * r.e[1] - l.e[1] * r.e[0]);
-    }
+    friend T dot(const Vector3<T> &l, const Vector3<T> &r) noexcept { return Lanes::dot(l.reg(), r.reg());}
+    friend Vector3<T> cross(const Vector3<T> &l, const Vector3<T> &r) noexcept { return of(Lanes::cross(l.reg(), r.reg()));}
     friend std::ostream& operator<<(std::ostream &out, const Vector3<T> &r) {
         out << r.e[0] << ' ' << r.e[1] << ' ' << r.e[2];
         return out;
@@ -82,31 +81,33 @@ public:
             return tmp.unit();
         }
     }
+
+private:
+    typename Lanes::Reg reg() const noexcept { return Lanes::load(e);}
+    static Vector3<T> of(typename Lanes::Reg a) noexcept {
+        Vector3<T> v;
+        Lanes::store(v.e, a);
+        return v;
+    }
 };
 
 template<typename T>
 Vector3<T>& Vector3<T>::operator-=(const Vector3<T>& r) noexcept {
-    e[0] -= r[0];
-    e[1] -= r[1];
-    e[2] -= r[2];
+    Lanes::store(e, Lanes::sub(reg(), r.reg()));
 
     return *this;
 }
 
 template<typename T>
 Vector3<T>& Vector3<T>::operator+=(const Vector3<T>& r) noexcept {
-    e[0] += r[0];
-    e[1] += r[1];
-    e[2] += r[2];
+    Lanes::store(e, Lanes::add(reg(), r.reg()));
 
     return *this;
 }
 
 template<typename T>
 Vector3<T>& Vector3<T>::operator*=(const T a) noexcept {
-    e[0] *= a;
-    e[1] *= a;
-    e[2] *= a;
+    Lanes::store(e, Lanes::mul(reg(), Lanes::set1(a)));
 
     return *this;
 }
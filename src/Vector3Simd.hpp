@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+
+#if defined(SIMD_VECTOR3) && (defined(__SSE2__) || defined(_M_X64))
+#include <immintrin.h>
+#define VECTOR3_SIMD_DOUBLE 1
+#endif
+
+
+//Register view of the components of a Vector3<T>. The generic version keeps three unpadded
+//components and plain scalar arithmetic; float stays with it since float vectors only hold
+//BVH node bounds, which have to fit the packed 32-byte nodes.
+template<class T>
+class Vector3Lanes {
+public:
+    static constexpr int size = 3;
+    static constexpr size_t align = alignof(T);
+
+    class Reg {
+    public:
+        T v[3];
+    };
+
+    static Reg load(const T* p) noexcept { return Reg{{p[0], p[1], p[2]}};}
+    static void store(T* p, const Reg& a) noexcept { p[0] = a.v[0]; p[1] = a.v[1]; p[2] = a.v[2];}
+    static Reg set1(T a) noexcept { return Reg{{a, a, a}};}
+
+    static Reg add(const Reg& a, const Reg& b) noexcept { return Reg{{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2]}};}
+    static Reg sub(const Reg& a, const Reg& b) noexcept { return Reg{{a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2]}};}
+    static Reg mul(const Reg& a, const Reg& b) noexcept { return Reg{{a.v[0]*b.v[0], a.v[1]*b.v[1], a.v[2]*b.v[2]}};}
+
+    static T dot(const Reg& a, const Reg& b) noexcept { return a.v[0]*b.v[0] + a.v[1]*b.v[1] + a.v[2]*b.v[2];}
+    static Reg cross(const Reg& a, const Reg& b) noexcept {
+        return Reg{{a.v[1]*b.v[2] - a.v[2]*b.v[1],
+                    a.v[2]*b.v[0] - a.v[0]*b.v[2],
+                    a.v[0]*b.v[1] - a.v[1]*b.v[0]}};
+    }
+};
+
+#if defined(VECTOR3_SIMD_DOUBLE)
+//double components padded to 4 lanes, the last one kept at 0: one AVX register, or an xy and
+//a z0 SSE2 register without AVX. Loads are unaligned since C++11 new only guarantees 16 bytes.
+template<>
+class Vector3Lanes<double> {
+public:
+    static constexpr int size = 4;
+    static constexpr size_t align = 16;
+
+#if defined(__AVX__)
+    using Reg = __m256d;
+
+    static Reg load(const double* p) noexcept { return _mm256_loadu_pd(p);}
+    static void store(double* p, Reg a) noexcept { _mm256_storeu_pd(p, a);}
+    static Reg set1(double a) noexcept { return _mm256_set_pd(0, a, a, a);}
+
+    static Reg add(Reg a, Reg b) noexcept { return _mm256_add_pd(a, b);}
+    static Reg sub(Reg a, Reg b) noexcept { return _mm256_sub_pd(a, b);}
+    static Reg mul(Reg a, Reg b) noexcept { return _mm256_mul_pd(a, b);}
+
+    static __m128d low(Reg a) noexcept { return _mm256_castpd256_pd128(a);}
+    static __m128d high(Reg a) noexcept { return _mm256_extractf128_pd(a, 1);}
+    static Reg join(__m128d lo, __m128d hi) noexcept { return _mm256_insertf128_pd(_mm256_castpd128_pd256(lo), hi, 1);}
+#else
+    class Reg {
+    public:
+        __m128d xy, zw;
+    };
+
+    static Reg load(const double* p) noexcept { return Reg{_mm_loadu_pd(p), _mm_loadu_pd(p + 2)};}
+    static void store(double* p, Reg a) noexcept { _mm_storeu_pd(p, a.xy); _mm_storeu_pd(p + 2, a.zw);}
+    static Reg set1(double a) noexcept { return Reg{_mm_set1_pd(a), _mm_set_pd(0, a)};}
+
+    static Reg add(Reg a, Reg b) noexcept { return Reg{_mm_add_pd(a.xy, b.xy), _mm_add_pd(a.zw, b.zw)};}
+    static Reg sub(Reg a, Reg b) noexcept { return Reg{_mm_sub_pd(a.xy, b.xy), _mm_sub_pd(a.zw, b.zw)};}
+    static Reg mul(Reg a, Reg b) noexcept { return Reg{_mm_mul_pd(a.xy, b.xy), _mm_mul_pd(a.zw, b.zw)};}
+
+    static __m128d low(Reg a) noexcept { return a.xy;}
+    static __m128d high(Reg a) noexcept { return a.zw;}
+    static Reg join(__m128d lo, __m128d hi) noexcept { return Reg{lo, hi};}
+#endif
+
+    //the padding lane is left out, so it never leaks into the sum
+    static double dot(Reg a, Reg b) noexcept {
+        Reg m = mul(a, b);
+        __m128d xy = low(m);
+        __m128d s = _mm_add_sd(xy, _mm_unpackhi_pd(xy, xy));
+        return _mm_cvtsd_f64(_mm_add_sd(s, high(m)));
+    }
+
+    //a.yzx*b.zxy - a.zxy*b.yzx, built from the two halves
+    static Reg cross(Reg a, Reg b) noexcept {
+        __m128d a_xy = low(a), a_zw = high(a), b_xy = low(b), b_zw = high(b);
+        __m128d a_yz = _mm_shuffle_pd(a_xy, a_zw, 1), a_zx = _mm_shuffle_pd(a_zw, a_xy, 0);
+        __m128d a_xw = _mm_shuffle_pd(a_xy, a_zw, 2), a_yw = _mm_shuffle_pd(a_xy, a_zw, 3);
+        __m128d b_yz = _mm_shuffle_pd(b_xy, b_zw, 1), b_zx = _mm_shuffle_pd(b_zw, b_xy, 0);
+        __m128d b_xw = _mm_shuffle_pd(b_xy, b_zw, 2), b_yw = _mm_shuffle_pd(b_xy, b_zw, 3);
+        return join(_mm_sub_pd(_mm_mul_pd(a_yz, b_zx), _mm_mul_pd(a_zx, b_yz)),
+                    _mm_sub_pd(_mm_mul_pd(a_xw, b_yw), _mm_mul_pd(a_yw, b_xw)));
+    }
+};
+#endif
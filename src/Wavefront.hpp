@@ -0,0 +1,302 @@
+#pragma once
+
+#include "General.hpp"
+#include "HittableObject.hpp"
+#include "Materials.hpp"
+#include "Camera.hpp"
+#include "Color.hpp"
+#include "BVH.hpp"
+#include "RayPacket.hpp"
+#include "Integrator.hpp"
+#include "Progress.hpp"
+#include "Ray.hpp"
+
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <typeinfo>
+#include <unordered_map>
+#include <cstdint>
+
+
+//Path states of one wave in SoA form: entry i of every array belongs to path i
+template<class T>
+class PathStates {
+public:
+    std::vector<Ray<T>> ray;
+    std::vector<Vector3<T>> throughput;
+    std::vector<int> pixel;
+    std::vector<int> bounces_left;
+    std::vector<HitRecord<T>> hit;
+    std::vector<char> alive;
+
+    size_t size() const noexcept { return pixel.size();}
+
+    void push(const Ray<T>& r, int _pixel, int bounces) {
+        ray.push_back(r);
+        throughput.emplace_back(1, 1, 1);
+        pixel.push_back(_pixel);
+        bounces_left.push_back(bounces);
+        hit.emplace_back();
+        alive.push_back(1);
+    }
+
+    //Path i takes the state of path order[i]
+    void permute(const std::vector<uint32_t>& order) {
+        permute(ray, order);
+        permute(throughput, order);
+        permute(pixel, order);
+        permute(bounces_left, order);
+        permute(hit, order);
+        permute(alive, order);
+    }
+
+    //Drops dead paths and keeps the order of the others
+    void compact() {
+        size_t out = 0;
+        for(size_t i = 0; i < size(); i++) {
+            if(!alive[i])
+                continue;
+            if(out != i) {
+                ray[out] = ray[i];
+                throughput[out] = throughput[i];
+                pixel[out] = pixel[i];
+                bounces_left[out] = bounces_left[i];
+                hit[out] = std::move(hit[i]);
+                alive[out] = 1;
+            }
+            out++;
+        }
+        ray.resize(out);
+        throughput.resize(out);
+        pixel.resize(out);
+        bounces_left.resize(out);
+        hit.resize(out);
+        alive.resize(out);
+    }
+
+private:
+    template<class V>
+    static void permute(std::vector<V>& v, const std::vector<uint32_t>& order) {
+        std::vector<V> tmp;
+        tmp.reserve(v.size());
+        for(auto i : order)
+            tmp.push_back(std::move(v[i]));
+        v.swap(tmp);
+    }
+};
+
+//Stream path tracer: instead of following one path down the recursion of ray_color, it keeps
+//a wave of paths and runs each stage over all of them: generate camera paths into free slots,
+//sort by ray origin and direction, intersect, sort by material, shade, then compact out the
+//finished paths. Paths are weighted and cut by Russian roulette as in path_radiance.
+template<class T>
+class WavefrontRenderer {
+public:
+    static constexpr size_t default_wave_size = 1 << 16;
+    static constexpr int packet_size = 8;
+
+    const HittableObject<T>& world;
+    const Camera<T>& cam;
+    Vector3<T> background;
+    int max_depth;
+    int roulette_depth = default_roulette_depth;
+    size_t wave_size;
+    bool sort_rays = true;
+    //Grouping by material costs more than it saves while shading is a cheap virtual call,
+    //it pays off once shading kernels work on whole groups
+    bool sort_materials = false;
+
+    WavefrontRenderer(const HittableObject<T>& _world, const Camera<T>& _cam, const Vector3<T>& _background,
+                      int _max_depth, size_t _wave_size = default_wave_size)
+        : world(_world), cam(_cam), background(_background), max_depth(_max_depth), wave_size(_wave_size), tracer(_world) {
+        if(!world.bounding_box(cam.time0, cam.time1, scene_box))
+            scene_box = AABB<T>(Vector3<T>(-1, -1, -1), Vector3<T>(1, 1, 1));
+    }
+
+    //Renders rows [begin, end) of image with spp samples per pixel; progress counts finished pixels
+    void render(IMAGE& image, int begin, int end, int spp, Progress* progress = nullptr);
+
+private:
+    PacketTracer<T, packet_size> tracer;
+    AABB<T> scene_box;
+
+    void sort_by_ray(PathStates<T>&) const;
+    void sort_by_material(PathStates<T>&) const;
+    void intersect(PathStates<T>&, std::vector<Vector3<T>>&) const;
+    void shade(PathStates<T>&, std::vector<Vector3<T>>&) const;
+};
+
+template<class T>
+void WavefrontRenderer<T>::render(IMAGE& image, int begin, int end, int spp, Progress* progress) {
+    const int width = image.width;
+    const size_t n_pixels = static_cast<size_t>(width)*(end - begin);
+    const size_t total = n_pixels*spp;
+
+    std::vector<Vector3<T>> radiance(n_pixels);
+    std::vector<int> samples_left(n_pixels, spp);
+    PathStates<T> paths;
+    size_t next = 0;
+
+    //pixels finished in a stage are reported together
+    auto retire = [&](PathStates<T>& states) {
+        size_t finished = 0;
+        for(size_t i = 0; i < states.size(); i++) {
+            if(!states.alive[i] && --samples_left[states.pixel[i]] == 0)
+                finished++;
+        }
+        if(progress && finished > 0)
+            progress->add(finished);
+        states.compact();
+    };
+
+    while(true) {
+        //generate: new camera paths take the slots freed by finished ones
+        while(paths.size() < wave_size && next < total) {
+            int p = static_cast<int>(next/spp);
+            next++;
+            int i = p%width;
+            int j = end - 1 - p/width;
+            T u = (i + random<T>(-1, 1))/(width - 1);
+            T v = (j + random<T>(-1, 1))/(image.height - 1);
+            paths.push(cam.get_ray(u, v), p, max_depth);
+        }
+        if(paths.size() == 0)
+            break;
+
+        if(sort_rays)
+            sort_by_ray(paths);
+        intersect(paths, radiance);
+        retire(paths);
+
+        if(sort_materials)
+            sort_by_material(paths);
+        shade(paths, radiance);
+        retire(paths);
+    }
+
+    for(size_t p = 0; p < n_pixels; p++)
+        write_color(image, end - 1 - static_cast<int>(p/width), static_cast<int>(p%width), radiance[p], spp);
+}
+
+//Neighbouring paths end up with the same direction octant and nearby origins
+template<class T>
+void WavefrontRenderer<T>::sort_by_ray(PathStates<T>& paths) const {
+    //key in the high half, path index in the low half, so a plain sort yields the order
+    std::vector<uint64_t> keys(paths.size());
+    Vector3<T> extent = scene_box.maximum - scene_box.minimum;
+
+    for(size_t i = 0; i < paths.size(); i++) {
+        const auto& r = paths.ray[i];
+        uint32_t q[3];
+        uint32_t octant = 0;
+        for(int a = 0; a < 3; a++) {
+            T s = extent.e[a] > 0 ? (r.orig.e[a] - scene_box.minimum.e[a])/extent.e[a] : 0;
+            q[a] = static_cast<uint32_t>(clamp<T>(s, 0, 1)*511);
+            octant |= static_cast<uint32_t>(r.dir.e[a] < 0) << a;
+        }
+        uint32_t morton = (expand_morton_bits(q[0]) << 2) | (expand_morton_bits(q[1]) << 1) | expand_morton_bits(q[2]);
+        keys[i] = static_cast<uint64_t>(octant << 27 | morton) << 32 | i;
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<uint32_t> order(paths.size());
+    for(size_t i = 0; i < keys.size(); i++)
+        order[i] = static_cast<uint32_t>(keys[i]);
+    paths.permute(order);
+}
+
+//Paths hitting the same material type, and within it the same material, become contiguous
+template<class T>
+void WavefrontRenderer<T>::sort_by_material(PathStates<T>& paths) const {
+    //rank the distinct materials, then counting sort the paths by rank
+    std::unordered_map<const Material<T>*, uint32_t> rank_of;
+    for(const auto& rec : paths.hit)
+        rank_of.emplace(rec.mat_ptr, 0);
+
+    std::vector<const Material<T>*> materials;
+    materials.reserve(rank_of.size());
+    for(const auto& m : rank_of)
+        materials.push_back(m.first);
+    std::sort(materials.begin(), materials.end(), [](const Material<T>* a, const Material<T>* b) {
+        size_t ta = typeid(*a).hash_code(), tb = typeid(*b).hash_code();
+        return ta != tb ? ta < tb : a < b;
+    });
+    for(size_t r = 0; r < materials.size(); r++)
+        rank_of[materials[r]] = static_cast<uint32_t>(r);
+
+    std::vector<uint32_t> rank(paths.size());
+    std::vector<uint32_t> start(materials.size() + 1, 0);
+    for(size_t i = 0; i < paths.size(); i++) {
+        rank[i] = rank_of[paths.hit[i].mat_ptr];
+        start[rank[i] + 1]++;
+    }
+    std::partial_sum(start.begin(), start.end(), start.begin());
+
+    std::vector<uint32_t> order(paths.size());
+    for(size_t i = 0; i < paths.size(); i++)
+        order[start[rank[i]]++] = static_cast<uint32_t>(i);
+    paths.permute(order);
+}
+
+//Paths that miss pick up the background and end. Runs of camera paths are coherent
+//and traced as packets, bounces one by one.
+template<class T>
+void WavefrontRenderer<T>::intersect(PathStates<T>& paths, std::vector<Vector3<T>>& radiance) const {
+    for(size_t start = 0; start < paths.size(); start += packet_size) {
+        int n = static_cast<int>(std::min<size_t>(packet_size, paths.size() - start));
+        bool primary = max_depth > 0;
+        for(int k = 0; k < n; k++)
+            primary = primary && paths.bounces_left[start + k] == max_depth;
+
+        //shade retires paths that used up their bounces, only camera paths with max_depth < 1 are left to skip
+        bool hits[packet_size];
+        if(primary) {
+            tracer.trace(&paths.ray[start], n, 0.0001, infinity, &paths.hit[start], hits);
+        } else {
+            for(int k = 0; k < n; k++)
+                hits[k] = paths.bounces_left[start + k] > 0 && world.hit(paths.ray[start + k], 0.0001, infinity, paths.hit[start + k]);
+        }
+
+        for(int k = 0; k < n; k++) {
+            size_t i = start + k;
+            if(paths.bounces_left[i] < 1) {
+                paths.alive[i] = 0;
+            } else if(!hits[k]) {
+                radiance[paths.pixel[i]] += paths.throughput[i]*background;
+                paths.alive[i] = 0;
+            } else {
+                paths.bounces_left[i]--;
+            }
+        }
+    }
+}
+
+template<class T>
+void WavefrontRenderer<T>::shade(PathStates<T>& paths, std::vector<Vector3<T>>& radiance) const {
+    for(size_t i = 0; i < paths.size(); i++) {
+        const auto& rec = paths.hit[i];
+        const auto& mat = *rec.mat_ptr;
+        radiance[paths.pixel[i]] += paths.throughput[i]*material_emitted(mat, rec.u, rec.v, rec.p);
+
+        //the scattered ray would only be cast to find the path out of bounces
+        if(paths.bounces_left[i] < 1) {
+            paths.alive[i] = 0;
+            continue;
+        }
+
+        Vector3<T> attenuation;
+        Ray<T> scattered;
+        if(!material_scatter(mat, paths.ray[i], rec, attenuation, scattered)) {
+            paths.alive[i] = 0;
+            continue;
+        }
+
+        paths.throughput[i] = paths.throughput[i]*attenuation;
+        paths.ray[i] = scattered;
+
+        int bounce = max_depth - 1 - paths.bounces_left[i];
+        if(bounce + 1 >= roulette_depth && !russian_roulette(paths.throughput[i]))
+            paths.alive[i] = 0;
+    }
+}
@@ -0,0 +1,389 @@
+#pragma once
+
+#include "General.hpp"
+#include "HittableObject.hpp"
+#include "HittableList.hpp"
+#include "LinearBVH.hpp"
+#include "Ray.hpp"
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+
+//N slab-test lanes; the portable version is plain arrays,
+//the specializations below map onto SSE/AVX registers
+template<class T, int N>
+class WideLanes {
+public:
+    T v[N];
+
+    template<class U>
+    static WideLanes load(const U* p) { WideLanes r; for(int i = 0; i < N; i++) r.v[i] = p[i]; return r;}
+    static WideLanes set1(T a) { WideLanes r; for(int i = 0; i < N; i++) r.v[i] = a; return r;}
+    void store(T* out) const { for(int i = 0; i < N; i++) out[i] = v[i];}
+
+    friend WideLanes operator+(const WideLanes& a, const WideLanes& b) { WideLanes r; for(int i = 0; i < N; i++) r.v[i] = a.v[i] + b.v[i]; return r;}
+    friend WideLanes operator-(const WideLanes& a, const WideLanes& b) { WideLanes r; for(int i = 0; i < N; i++) r.v[i] = a.v[i] - b.v[i]; return r;}
+    friend WideLanes operator*(const WideLanes& a, const WideLanes& b) { WideLanes r; for(int i = 0; i < N; i++) r.v[i] = a.v[i]*b.v[i]; return r;}
+    static WideLanes min(const WideLanes& a, const WideLanes& b) { WideLanes r; for(int i = 0; i < N; i++) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return r;}
+    static WideLanes max(const WideLanes& a, const WideLanes& b) { WideLanes r; for(int i = 0; i < N; i++) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return r;}
+    static WideLanes sqrt(const WideLanes& a) { WideLanes r; for(int i = 0; i < N; i++) r.v[i] = std::sqrt(a.v[i]); return r;}
+    static int le_mask(const WideLanes& a, const WideLanes& b) {
+        int mask = 0;
+        for(int i = 0; i < N; i++)
+            mask |= (a.v[i] <= b.v[i]) << i;
+        return mask;
+    }
+};
+
+#if defined(__SSE2__) || defined(_M_X64)
+template<>
+class WideLanes<float, 4> {
+public:
+    __m128 v;
+
+    static WideLanes load(const float* p) { return {_mm_loadu_ps(p)};}
+    static WideLanes set1(float a) { return {_mm_set1_ps(a)};}
+    void store(float* out) const { _mm_storeu_ps(out, v);}
+
+    friend WideLanes operator+(const WideLanes& a, const WideLanes& b) { return {_mm_add_ps(a.v, b.v)};}
+    friend WideLanes operator-(const WideLanes& a, const WideLanes& b) { return {_mm_sub_ps(a.v, b.v)};}
+    friend WideLanes operator*(const WideLanes& a, const WideLanes& b) { return {_mm_mul_ps(a.v, b.v)};}
+    static WideLanes min(const WideLanes& a, const WideLanes& b) { return {_mm_min_ps(a.v, b.v)};}
+    static WideLanes max(const WideLanes& a, const WideLanes& b) { return {_mm_max_ps(a.v, b.v)};}
+    static WideLanes sqrt(const WideLanes& a) { return {_mm_sqrt_ps(a.v)};}
+    static int le_mask(const WideLanes& a, const WideLanes& b) { return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v));}
+};
+#endif
+
+#if defined(__AVX__)
+template<>
+class WideLanes<float, 8> {
+public:
+    __m256 v;
+
+    static WideLanes load(const float* p) { return {_mm256_loadu_ps(p)};}
+    static WideLanes set1(float a) { return {_mm256_set1_ps(a)};}
+    void store(float* out) const { _mm256_storeu_ps(out, v);}
+
+    friend WideLanes operator+(const WideLanes& a, const WideLanes& b) { return {_mm256_add_ps(a.v, b.v)};}
+    friend WideLanes operator-(const WideLanes& a, const WideLanes& b) { return {_mm256_sub_ps(a.v, b.v)};}
+    friend WideLanes operator*(const WideLanes& a, const WideLanes& b) { return {_mm256_mul_ps(a.v, b.v)};}
+    static WideLanes min(const WideLanes& a, const WideLanes& b) { return {_mm256_min_ps(a.v, b.v)};}
+    static WideLanes max(const WideLanes& a, const WideLanes& b) { return {_mm256_max_ps(a.v, b.v)};}
+    static WideLanes sqrt(const WideLanes& a) { return {_mm256_sqrt_ps(a.v)};}
+    static int le_mask(const WideLanes& a, const WideLanes& b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ));}
+};
+
+//double rays keep full precision: float bounds are widened on load
+template<>
+class WideLanes<double, 4> {
+public:
+    __m256d v;
+
+    static WideLanes load(const float* p) { return {_mm256_cvtps_pd(_mm_loadu_ps(p))};}
+    static WideLanes load(const double* p) { return {_mm256_loadu_pd(p)};}
+    static WideLanes set1(double a) { return {_mm256_set1_pd(a)};}
+    void store(double* out) const { _mm256_storeu_pd(out, v);}
+
+    friend WideLanes operator+(const WideLanes& a, const WideLanes& b) { return {_mm256_add_pd(a.v, b.v)};}
+    friend WideLanes operator-(const WideLanes& a, const WideLanes& b) { return {_mm256_sub_pd(a.v, b.v)};}
+    friend WideLanes operator*(const WideLanes& a, const WideLanes& b) { return {_mm256_mul_pd(a.v, b.v)};}
+    static WideLanes min(const WideLanes& a, const WideLanes& b) { return {_mm256_min_pd(a.v, b.v)};}
+    static WideLanes max(const WideLanes& a, const WideLanes& b) { return {_mm256_max_pd(a.v, b.v)};}
+    static WideLanes sqrt(const WideLanes& a) { return {_mm256_sqrt_pd(a.v)};}
+    static int le_mask(const WideLanes& a, const WideLanes& b) { return _mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ));}
+};
+
+template<>
+class WideLanes<double, 8> {
+public:
+    __m256d lo, hi;
+
+    static WideLanes load(const float* p) { return {_mm256_cvtps_pd(_mm_loadu_ps(p)), _mm256_cvtps_pd(_mm_loadu_ps(p + 4))};}
+    static WideLanes load(const double* p) { return {_mm256_loadu_pd(p), _mm256_loadu_pd(p + 4)};}
+    static WideLanes set1(double a) { return {_mm256_set1_pd(a), _mm256_set1_pd(a)};}
+    void store(double* out) const { _mm256_storeu_pd(out, lo); _mm256_storeu_pd(out + 4, hi);}
+
+    friend WideLanes operator+(const WideLanes& a, const WideLanes& b) { return {_mm256_add_pd(a.lo, b.lo), _mm256_add_pd(a.hi, b.hi)};}
+    friend WideLanes operator-(const WideLanes& a, const WideLanes& b) { return {_mm256_sub_pd(a.lo, b.lo), _mm256_sub_pd(a.hi, b.hi)};}
+    friend WideLanes operator*(const WideLanes& a, const WideLanes& b) { return {_mm256_mul_pd(a.lo, b.lo), _mm256_mul_pd(a.hi, b.hi)};}
+    static WideLanes min(const WideLanes& a, const WideLanes& b) { return {_mm256_min_pd(a.lo, b.lo), _mm256_min_pd(a.hi, b.hi)};}
+    static WideLanes max(const WideLanes& a, const WideLanes& b) { return {_mm256_max_pd(a.lo, b.lo), _mm256_max_pd(a.hi, b.hi)};}
+    static WideLanes sqrt(const WideLanes& a) { return {_mm256_sqrt_pd(a.lo), _mm256_sqrt_pd(a.hi)};}
+    static int le_mask(const WideLanes& a, const WideLanes& b) {
+        return _mm256_movemask_pd(_mm256_cmp_pd(a.lo, b.lo, _CMP_LE_OQ)) | (_mm256_movemask_pd(_mm256_cmp_pd(a.hi, b.hi, _CMP_LE_OQ)) << 4);
+    }
+};
+#elif defined(__SSE2__) || defined(_M_X64)
+template<>
+class WideLanes<double, 4> {
+public:
+    __m128d lo, hi;
+
+    static WideLanes load(const float* p) {
+        __m128 f = _mm_loadu_ps(p);
+        return {_mm_cvtps_pd(f), _mm_cvtps_pd(_mm_movehl_ps(f, f))};
+    }
+    static WideLanes load(const double* p) { return {_mm_loadu_pd(p), _mm_loadu_pd(p + 2)};}
+    static WideLanes set1(double a) { return {_mm_set1_pd(a), _mm_set1_pd(a)};}
+    void store(double* out) const { _mm_storeu_pd(out, lo); _mm_storeu_pd(out + 2, hi);}
+
+    friend WideLanes operator+(const WideLanes& a, const WideLanes& b) { return {_mm_add_pd(a.lo, b.lo), _mm_add_pd(a.hi, b.hi)};}
+    friend WideLanes operator-(const WideLanes& a, const WideLanes& b) { return {_mm_sub_pd(a.lo, b.lo), _mm_sub_pd(a.hi, b.hi)};}
+    friend WideLanes operator*(const WideLanes& a, const WideLanes& b) { return {_mm_mul_pd(a.lo, b.lo), _mm_mul_pd(a.hi, b.hi)};}
+    static WideLanes min(const WideLanes& a, const WideLanes& b) { return {_mm_min_pd(a.lo, b.lo), _mm_min_pd(a.hi, b.hi)};}
+    static WideLanes max(const WideLanes& a, const WideLanes& b) { return {_mm_max_pd(a.lo, b.lo), _mm_max_pd(a.hi, b.hi)};}
+    static WideLanes sqrt(const WideLanes& a) { return {_mm_sqrt_pd(a.lo), _mm_sqrt_pd(a.hi)};}
+    static int le_mask(const WideLanes& a, const WideLanes& b) {
+        return _mm_movemask_pd(_mm_cmple_pd(a.lo, b.lo)) | (_mm_movemask_pd(_mm_cmple_pd(a.hi, b.hi)) << 2);
+    }
+};
+#endif
+
+//Children bounds in SoA form: bounds[axis] are the minimums, bounds[3 + axis] the maximums.
+//Empty slots have inverted bounds and child -1; hit skips them by child, since the NaN-safe
+//slab test lets an inverted box through.
+template<int N>
+class alignas(32) WideBvhNode {
+public:
+    float bounds[6][N];
+    int32_t child[N]; // wide node index, or first primitive for leaf children
+    uint16_t count[N]; // number of primitives for leaf children, 0 for inner children
+
+    WideBvhNode() {
+        for(int i = 0; i < N; i++) {
+            for(int a = 0; a < 3; a++) {
+                bounds[a][i] = std::numeric_limits<float>::infinity();
+                bounds[3 + a][i] = -std::numeric_limits<float>::infinity();
+            }
+            child[i] = -1;
+            count[i] = 0;
+        }
+    }
+};
+
+//BVH4/BVH8: a binary LinearBvh collapsed so every node tests N children at once
+template<class T, int N>
+class WideBvh : public HittableObject<T> {
+public:
+    static_assert(N == 4 || N == 8, "WideBvh supports 4 or 8 children");
+    static constexpr int max_depth = 64;
+
+    std::vector<std::shared_ptr<HittableObject<T>>> primitives; // in leaf order
+    std::vector<WideBvhNode<N>> nodes;
+    AABB<T> root_box;
+
+    WideBvh() {}
+    WideBvh(const LinearBvh<T>&);
+    WideBvh(const HittableList<T>& list, T time0, T time1, BvhSplit split = BvhSplit::SAH)
+        : WideBvh(LinearBvh<T>(list, time0, time1, split)) {}
+
+    bool hit(const Ray<T>&, T, T, HitRecord<T>&) const noexcept override;
+    bool bounding_box(T, T, AABB<T>& out) const override {
+        out = root_box;
+        return !nodes.empty();
+    }
+
+    //Recomputes child bounds for objects that moved, the topology is kept
+    void refit(T time0, T time1) {
+        if(!nodes.empty())
+            root_box = refit_node(0, time0, time1);
+    }
+
+private:
+    int collapse(const LinearBvh<T>&, int);
+    AABB<T> refit_node(int, T, T);
+};
+
+template<class T, int N>
+WideBvh<T, N>::WideBvh(const LinearBvh<T>& bvh) : primitives(bvh.primitives) {
+    if(bvh.nodes.empty())
+        return;
+    //collapsing never adds levels, so the traversal stack fits if the source tree does
+    int height = bvh_tree_height(bvh.nodes);
+    if(height < 0 || height > max_depth)
+        throw std::invalid_argument("WideBvh: source tree is malformed or deeper than max_depth");
+
+    bvh.bounding_box(0, 0, root_box);
+    collapse(bvh, 0);
+}
+
+template<class T, int N>
+int WideBvh<T, N>::collapse(const LinearBvh<T>& bvh, int root) {
+    int idx = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+
+    int kids[N];
+    int n_kids = 0;
+    if(bvh.nodes[root].count > 0) {
+        kids[n_kids++] = root;
+    } else {
+        kids[n_kids++] = bvh.nodes[root].offset;
+        kids[n_kids++] = bvh.nodes[root].offset + 1;
+    }
+
+    //open the largest inner child until all N slots are used
+    while(n_kids < N) {
+        int best = -1;
+        float best_area = -1;
+        for(int i = 0; i < n_kids; i++) {
+            const auto& k = bvh.nodes[kids[i]];
+            if(k.count == 0 && k.box.surface_area() > best_area) {
+                best = i;
+                best_area = k.box.surface_area();
+            }
+        }
+        if(best < 0)
+            break;
+
+        int opened = kids[best];
+        kids[best] = bvh.nodes[opened].offset;
+        kids[n_kids++] = bvh.nodes[opened].offset + 1;
+    }
+
+    for(int i = 0; i < n_kids; i++) {
+        const auto& k = bvh.nodes[kids[i]];
+        int32_t child = k.count > 0 ? k.offset : collapse(bvh, kids[i]);
+
+        auto& node = nodes[idx];
+        for(int a = 0; a < 3; a++) {
+            node.bounds[a][i] = k.box.minimum.e[a];
+            node.bounds[3 + a][i] = k.box.maximum.e[a];
+        }
+        node.child[i] = child;
+        node.count[i] = k.count;
+    }
+
+    return idx;
+}
+
+template<class T, int N>
+AABB<T> WideBvh<T, N>::refit_node(int idx, T t0, T t1) {
+    AABB<T> total;
+    bool first = true;
+
+    for(int i = 0; i < N; i++) {
+        int32_t child = nodes[idx].child[i];
+        int count = nodes[idx].count[i];
+        if(child < 0)
+            continue;
+
+        AABB<T> box, tmp;
+        if(count > 0) {
+            primitives[child]->bounding_box(t0, t1, box);
+            for(int p = 1; p < count; p++) {
+                primitives[child + p]->bounding_box(t0, t1, tmp);
+                box = AABB<T>::surrounding_box(box, tmp);
+            }
+        } else {
+            box = refit_node(child, t0, t1);
+        }
+
+        auto f = conservative_box(box);
+        for(int a = 0; a < 3; a++) {
+            nodes[idx].bounds[a][i] = f.minimum.e[a];
+            nodes[idx].bounds[3 + a][i] = f.maximum.e[a];
+        }
+
+        total = first ? box : AABB<T>::surrounding_box(total, box);
+        first = false;
+    }
+
+    return total;
+}
+
+template<class T, int N>
+bool WideBvh<T, N>::hit(const Ray<T>& r, T t_min, T t_max, HitRecord<T>& rec) const noexcept {
+    if(nodes.empty())
+        return false;
+
+    using Lanes = WideLanes<T, N>;
+
+    const Vector3<T> inv_dir(1/r.dir.e[0], 1/r.dir.e[1], 1/r.dir.e[2]);
+    Lanes orig[3], inv[3];
+    for(int a = 0; a < 3; a++) {
+        orig[a] = Lanes::set1(r.orig.e[a]);
+        inv[a] = Lanes::set1(inv_dir.e[a]);
+    }
+
+    int stack[max_depth*(N - 1) + 1];
+    int stack_size = 0;
+    int current = 0;
+    bool hit_any = false;
+
+    while(true) {
+        const auto& node = nodes[current];
+
+        Lanes t_near = Lanes::set1(t_min);
+        Lanes t_far = Lanes::set1(t_max);
+        for(int a = 0; a < 3; a++) {
+            Lanes t0 = (Lanes::load(node.bounds[a]) - orig[a])*inv[a];
+            Lanes t1 = (Lanes::load(node.bounds[3 + a]) - orig[a])*inv[a];
+            //a ray in a face plane with a zero direction component gets 0*inf = NaN; min and max
+            //return their second operand then, so NaN falls back to t_near/t_far as in slab_hit
+            t_near = Lanes::min(Lanes::max(t0, t_near), Lanes::max(t1, t_near));
+            t_far = Lanes::max(Lanes::min(t0, t_far), Lanes::min(t1, t_far));
+        }
+        int mask = Lanes::le_mask(t_near, t_far);
+
+        if(mask) {
+            T dist[N];
+            t_near.store(dist);
+
+            //hit children from near to far
+            int order[N];
+            int n_hit = 0;
+            for(int i = 0; i < N; i++) {
+                if(!(mask & (1 << i)) || node.child[i] < 0)
+                    continue;
+                int j = n_hit++;
+                for(; j > 0 && dist[order[j - 1]] > dist[i]; j--)
+                    order[j] = order[j - 1];
+                order[j] = i;
+            }
+
+            //leaves are intersected right away, inner nodes are pushed so the nearest is popped first
+            int inner[N];
+            int n_inner = 0;
+            for(int k = 0; k < n_hit; k++) {
+                int i = order[k];
+                if(node.count[i] == 0) {
+                    inner[n_inner++] = node.child[i];
+                    continue;
+                }
+                if(dist[i] > t_max)
+                    continue;
+                for(int p = 0; p < node.count[i]; p++) {
+                    if(primitives[node.child[i] + p]->hit(r, t_min, t_max, rec)) {
+                        hit_any = true;
+                        t_max = rec.t;
+                    }
+                }
+            }
+            for(int k = n_inner - 1; k >= 0; k--)
+                stack[stack_size++] = inner[k];
+        }
+
+        if(stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+
+    return hit_any;
+}
+
+template<class T>
+using Bvh4 = WideBvh<T, 4>;
+
+template<class T>
+using Bvh8 = WideBvh<T, 8>;